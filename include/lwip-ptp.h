@@ -22,7 +22,7 @@
 /**
  * @brief number of timers that LWIP_PTP uses. Can be used by the driver.
  */
-#define LWIP_PTP_NUM_TIMERS         6
+#define LWIP_PTP_NUM_TIMERS         7
 
 /*----------------------------- PUBLIC FUNCTIONS -----------------------------*/
 
@@ -44,6 +44,54 @@ void LWIP_PTP_SET_TIME(const timestamp_t*);
  */
 void LWIP_PTP_UPDATE_FINE(s32_t);
 
+#if defined LWIP_PTP_UPDATE_FINE_SCALED
+/**
+ * @brief Fine update the system time with sub-ppb resolution (optional,
+ * replaces LWIP_PTP_UPDATE_FINE).
+ * @param adj frequency adjustment in ppb with ADJ_FREQ_SCALE (16)
+ * fractional bits.
+ */
+void LWIP_PTP_UPDATE_FINE_SCALED(s64_t);
+#endif /* defined LWIP_PTP_UPDATE_FINE_SCALED */
+
+#if defined LWIP_PTP_ADJ_PHASE
+/**
+ * @brief Shift the system time by a signed offset in one atomic update
+ * (optional).
+ * @param adj nanoseconds to add to the system time.
+ */
+void LWIP_PTP_ADJ_PHASE(s32_t);
+#endif /* defined LWIP_PTP_ADJ_PHASE */
+
+#if defined LWIP_PTP_SAVE_DRIFT
+/**
+ * @brief Store the learned frequency correction in non-volatile memory
+ * (optional).
+ * @param drift long term averaged frequency correction in ppb.
+ * @param seconds PTP time the value was taken at.
+ */
+void LWIP_PTP_SAVE_DRIFT(s32_t, u32_t);
+
+/**
+ * @brief Read back the frequency correction stored by LWIP_PTP_SAVE_DRIFT
+ * (optional).
+ * @param drift filled with the stored frequency correction in ppb.
+ * @param seconds filled with the PTP time the value was taken at.
+ * @retval true if a value was stored, false otherwise.
+ */
+bool LWIP_PTP_RESTORE_DRIFT(s32_t*, u32_t*);
+#endif /* defined LWIP_PTP_SAVE_DRIFT */
+
+#if defined LWIP_PTP_GET_TEMPERATURE
+/**
+ * @brief Read the oscillator temperature (optional). Called every protocol
+ * iteration, so it should return a cached value.
+ * @param temperature filled with the temperature in degrees C * 1000.
+ * @retval true if a reading is available, false otherwise.
+ */
+bool LWIP_PTP_GET_TEMPERATURE(s32_t*);
+#endif /* defined LWIP_PTP_GET_TEMPERATURE */
+
 /**
  * @brief Initialise system timers. If the system timers already exist, they
  * must be deallocated before the new timers are created.
@@ -99,4 +147,182 @@ void lwipPtpInit(u8_t priority);
  */
 void lwipPtpTxNotify(void);
 
+/**
+ * @brief Install an authentication key (IEEE 1588-2019 Annex P). Once any key
+ * is installed, received messages without a valid AUTHENTICATION TLV are
+ * dropped. The key is queued and installed by the PTP thread, so a key-ID in
+ * use can be replaced at any time; it is dropped with an error logged if the
+ * key table is full by then. Only available when LWIP_PTP_AUTH is enabled.
+ * @param keyId key identifier carried in the TLV.
+ * @param key secret key octets.
+ * @param keyLength length of the key in octets.
+ * @param icvLength length of the truncated HMAC-SHA256 ICV (10 to 32 octets).
+ * @retval ERR_OK if the key was queued, ERR_ARG for a bad ICV length, ERR_MEM
+ * if LWIP_PTP_AUTH_MAX_KEYS other keys are still queued.
+ */
+err_t lwipPtpAuthSetKey(u32_t keyId, const u8_t *key, u16_t keyLength,
+                                                            u8_t icvLength);
+
+/**
+ * @brief Select the key used to sign outgoing messages. Applied by the PTP
+ * thread after the keys queued before it; an unknown key-ID is logged and
+ * ignored. Only available when LWIP_PTP_AUTH is enabled.
+ * @param keyId key identifier of an installed or queued key.
+ * @retval ERR_OK if the request was queued, or lwIP-style error code otherwise.
+ */
+err_t lwipPtpAuthSetTxKey(u32_t keyId);
+
+/**
+ * @brief Get the counters of the offset outlier gate.
+ * @param rejected filled with the number of offsets rejected as outliers.
+ * @param resets filled with the number of times persistent rejections were
+ * taken as a real step of the offset.
+ */
+void lwipPtpGetOutlierStats(u32_t *rejected, u32_t *resets);
+
+/**
+ * @brief Get the counters of the best master clock algorithm. Every valid
+ * Announce is a state decision event, but the state decision only runs when
+ * the ranking of the foreign masters, the local dataset or the port state
+ * changed since the last one.
+ * @param events filled with the number of state decision events.
+ * @param decisions filled with the number of state decisions run.
+ * @param rescans filled with the number of times all foreign masters had to
+ * be compared, after the best or the runner-up changed or went away.
+ */
+void lwipPtpGetBmcStats(u32_t *events, u32_t *decisions, u32_t *rescans);
+
+/**
+ * @brief Get the Sync receipt counters of the slave. A parent that keeps
+ * sending Announce messages without Sync messages for
+ * DEFAULT_SYNC_RECEIPT_TIMEOUT sync intervals is given up for another
+ * qualified master, or the clock holds its frequency until the Syncs return.
+ * @param missing filled with the number of Sync sequenceIds skipped.
+ * @param duplicate filled with the number of repeated Sync messages.
+ * @param outOfOrder filled with the number of Sync messages older than the
+ * last one. Duplicate and out of order Syncs are not used.
+ * @param timeouts filled with the number of Sync receipt timeouts.
+ */
+void lwipPtpGetSyncStats(u32_t *missing, u32_t *duplicate, u32_t *outOfOrder, u32_t *timeouts);
+
+/**
+ * @brief Get the holdover status. The clock is in holdover when it lost its
+ * master after learning a long term frequency estimate.
+ * @param duration filled with the seconds spent in holdover.
+ * @param error filled with the estimated time error in nanoseconds.
+ * @retval true if the clock is in holdover.
+ */
+bool lwipPtpGetHoldover(u32_t *duration, u32_t *error);
+
+/**
+ * @brief Get the learned frequency against temperature coefficient of the
+ * oscillator (only with LWIP_PTP_GET_TEMPERATURE).
+ * @param coeff filled with the coefficient in 10^-12 per degree C.
+ * @retval true if the coefficient is in use as temperature feed-forward.
+ */
+bool lwipPtpGetTempCoeff(s32_t *coeff);
+
+/**
+ * @brief Get the progress of a bounded slew catch-up. With servo.maxSlew set
+ * (DEFAULT_MAX_SLEW), the clock is never stepped once it has locked: an
+ * offset the servo cannot remove within one sync interval at that rate is
+ * slewed out at exactly maxSlew on top of the frequency estimate.
+ * @param remaining filled with the offset still to slew out in nanoseconds.
+ * @param seconds filled with the estimated time to completion.
+ * @param progress filled with the part of the offset slewed out, in percent.
+ * @retval true while catching up.
+ */
+bool lwipPtpGetCatchUp(s64_t *remaining, u32_t *seconds, u8_t *progress);
+
+/**
+ * @brief Get the hot standby status. A slave also measures its offset and
+ * path delay to the second best master from that master's Sync messages.
+ * When the parent's Announce messages time out and the standby is ready,
+ * the port fails over to it in SLAVE state with the servo still locked,
+ * instead of going through LISTENING and UNCALIBRATED.
+ * @param offset filled with the offset from the standby master in
+ * nanoseconds, i.e. how far it is from the parent.
+ * @param delay filled with the mean path delay to it in nanoseconds.
+ * @param switches filled with the number of failovers to a standby.
+ * @retval true if the standby is ready to take over.
+ */
+bool lwipPtpGetStandby(s32_t *offset, s32_t *delay, u32_t *switches);
+
+/**
+ * @brief Select the clock servo at run-time. The new servo starts without
+ * phase history from the frequency learned so far, and is kept across
+ * restarts of the stack. The PTP thread applies it at its next iteration.
+ * @param type SERVO_PI, SERVO_LINREG or SERVO_KALMAN (def/opt.h).
+ * @retval ERR_OK if the servo is built in, ERR_VAL otherwise.
+ */
+err_t lwipPtpSetServo(u8_t type);
+
+/**
+ * @brief Set the path delay asymmetry (IEEE 1588 11.6) of a link whose two
+ * directions differ in delay, e.g. fibres of different length. A positive
+ * value means Sync messages take longer than the mean path delay. It is
+ * applied on top of the inbound and outbound latencies, which only place the
+ * timestamps of this port at the wire. The PTP thread applies it at its next
+ * iteration, so it may also be called before the stack is running.
+ * @param asymmetry master to slave delay minus the mean path delay in
+ * nanoseconds.
+ */
+void lwipPtpSetDelayAsymmetry(s32_t asymmetry);
+
+/**
+ * @brief Get the path delay asymmetry in use, e.g. to store the result of a
+ * calibration.
+ * @retval master to slave delay minus the mean path delay in nanoseconds.
+ */
+s32_t lwipPtpGetDelayAsymmetry(void);
+
+/**
+ * @brief Calibrate the path delay asymmetry against a reference. Each call
+ * gives the true offset of the local clock from the master, measured
+ * independently (e.g. by comparing 1PPS outputs) just after a Sync. The
+ * calls are averaged into the asymmetry in use, which also absorbs any
+ * constant error of the inbound and outbound latencies.
+ * lwipPtpSetDelayAsymmetry() restarts the average.
+ * @param offset true offset of the local clock from the master in
+ * nanoseconds, positive if the local clock is ahead.
+ * The measurement is handed to the PTP thread, which averages it in at its
+ * next iteration.
+ * @retval ERR_OK if the measurement was queued, ERR_INPROGRESS if the last
+ * one has not been taken yet, ERR_VAL if the port is not a phase locked
+ * slave.
+ */
+err_t lwipPtpCalibrateDelayAsymmetry(s32_t offset);
+
+/**
+ * @brief Get the rate of the master relative to the free running local
+ * oscillator, e.g. for sample rate conversion. In the syntonization only
+ * mode (servo.syntonizeOnly) this is the only output: the clock frequency
+ * follows the master but its phase is never steered.
+ * @param ratio filled with (rateRatio - 1) * 2^41, the representation of
+ * cumulativeScaledRateOffset in IEEE 802.1AS.
+ * @retval true if the port is calibrated to its master.
+ */
+bool lwipPtpGetRateRatio(s32_t *ratio);
+
+/**
+ * @brief Get the stability of the offset from master for
+ * tau = 2^(octave + logSyncInterval) seconds, octave 0 .. STABILITY_OCTAVES - 1.
+ * @param octave tau in sync intervals, as a power of two.
+ * @param adev filled with the Allan deviation in units of 10^-12.
+ * @param tdev filled with the time deviation in nanoseconds.
+ * @param mtie filled with the maximum time interval error in nanoseconds.
+ * @retval true if there is an estimate for this tau.
+ */
+bool lwipPtpGetStability(u8_t octave, u32_t *adev, u32_t *tdev, u32_t *mtie);
+
+/**
+ * @brief Helper for LWIP_PTP_UPDATE_FINE_SCALED on MACs that count time with
+ * an addend register (e.g. STM32 ETH PTPTSAR): returns the addend that runs
+ * the clock 'adj' faster than the nominal addend 'base'.
+ * @param base addend giving the nominal clock rate.
+ * @param adj frequency adjustment in ppb with 16 fractional bits.
+ * @retval addend register value, base * (1 + adj / 2^16 / 10^9).
+ */
+u32_t lwipPtpAddend(u32_t base, s64_t adj);
+
 #endif /* __LWIP_PTP_H__ */
@@ -36,6 +36,24 @@ void scaledNanosecondsToInternalTime(const s64_t *scaledNanoseconds,
     internal->nanoseconds = sign * (nanoseconds % 1000000000);
 }
 
+/**
+ * \brief Convert TimeInternal structure into nanoseconds
+ */
+s64_t internalTimeToNanoseconds(const timeInternal_t *internal)
+{
+    return (s64_t)internal->seconds * 1000000000 + internal->nanoseconds;
+}
+
+/**
+ * \brief Convert nanoseconds into TimeInternal structure
+ */
+void nanosecondsToInternalTime(s64_t nanoseconds, timeInternal_t *internal)
+{
+    /* C division truncates, so both fields keep the sign of the value */
+    internal->seconds = (s32_t)(nanoseconds / 1000000000);
+    internal->nanoseconds = (s32_t)(nanoseconds % 1000000000);
+}
+
 /**
  * \brief Convert TimeInternal into Timestamp structure (defined by the spec)
  */
@@ -144,4 +162,98 @@ s32_t floorLog2(u32_t n)
     return pos;
 }
 
+/**
+ * \brief Returns a * b / c without overflowing 64 bits. The precision of
+ * ''a'' and ''c'' is reduced only as far as needed to keep the product in range.
+ */
+s64_t mulDiv64(s64_t a, s64_t b, s64_t c)
+{
+    bool negative = false;
+    u64_t ua, ub, uc;
+
+    if (c == 0)
+        return 0;
+
+    if (a < 0) { negative = !negative; ua = -(u64_t)a; } else { ua = a; }
+    if (b < 0) { negative = !negative; ub = -(u64_t)b; } else { ub = b; }
+    if (c < 0) { negative = !negative; uc = -(u64_t)c; } else { uc = c; }
+
+    /* Drop low order bits of the dividend and divisor together */
+    while (ub != 0 && ua > (u64_t)INT64_MAX / ub) {
+        ua >>= 1;
+        uc >>= 1;
+        if (uc == 0)
+            return negative ? -INT64_MAX : INT64_MAX;
+    }
+
+    ua = ua * ub / uc;
+    if (ua > (u64_t)INT64_MAX)
+        ua = INT64_MAX;
+
+    return negative ? -(s64_t)ua : (s64_t)ua;
+}
+
+/**
+ * \brief Returns the floor of the square root of a 64 bit integer.
+ */
+u32_t sqrt64(u64_t n)
+{
+    u64_t root = 0, bit = (u64_t)1 << 62;
+
+    while (bit > n)
+        bit >>= 2;
+
+    /* Digit by digit, two bits of n per bit of the root */
+    while (bit != 0) {
+        if (n >= root + bit) {
+            n -= root + bit;
+            root = (root >> 1) + bit;
+        }
+        else {
+            root >>= 1;
+        }
+        bit >>= 2;
+    }
+
+    return (u32_t)root;
+}
+
+/**
+ * \brief Returns the binary logarithm of a 64 bit integer with 8 fractional
+ * bits (log2(n) * 256). -1 is returned if ''n'' is 0.
+ */
+s32_t scaledLog2(u64_t n)
+{
+    s32_t result = 0;
+    u64_t m;
+    int i;
+
+    if (n == 0)
+        return -1;
+
+    /* Integer part, leaving the mantissa in [1, 2) with 30 fractional bits */
+    while (n >= ((u64_t)1 << 31)) {
+        n >>= 1;
+        result++;
+    }
+    while (n < ((u64_t)1 << 30)) {
+        n <<= 1;
+        result--;
+    }
+    result += 30;
+    m = n;
+
+    /* Fractional bits by repeated squaring */
+    for (i = 0; i < 8; i++) {
+        m = (m * m) >> 30;
+        result <<= 1;
+        if (m >= ((u64_t)2 << 30)) {
+            m >>= 1;
+            result |= 1;
+        }
+    }
+
+    return result;
+}
+
 #endif /* LWIP_PTP || defined __DOXYGEN__ */
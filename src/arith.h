@@ -18,6 +18,16 @@
 void scaledNanosecondsToInternalTime(const s64_t *scaledNanoseconds,
                                                     timeInternal_t *internal);
 
+/**
+ * \brief Convert TimeInternal structure into nanoseconds
+ */
+s64_t internalTimeToNanoseconds(const timeInternal_t *internal);
+
+/**
+ * \brief Convert nanoseconds into TimeInternal structure
+ */
+void nanosecondsToInternalTime(s64_t nanoseconds, timeInternal_t *internal);
+
 /**
  * \brief Convert TimeInternal into Timestamp structure (defined by the spec)
  */
@@ -55,4 +65,21 @@ void div2Time(timeInternal_t *r);
  */
 s32_t floorLog2(u32_t n);
 
+/**
+ * \brief Returns a * b / c without overflowing 64 bits. The precision of
+ * ''a'' and ''c'' is reduced only as far as needed to keep the product in range.
+ */
+s64_t mulDiv64(s64_t a, s64_t b, s64_t c);
+
+/**
+ * \brief Returns the floor of the square root of a 64 bit integer.
+ */
+u32_t sqrt64(u64_t n);
+
+/**
+ * \brief Returns the binary logarithm of a 64 bit integer with 8 fractional
+ * bits (log2(n) * 256). -1 is returned if ''n'' is 0.
+ */
+s32_t scaledLog2(u64_t n);
+
 #endif /* __LWIP_PTP_ARITH_H__ */
@@ -0,0 +1,458 @@
+/**
+ * @file
+ * @brief auth.c
+ * AUTHENTICATION TLV handling (IEEE 1588-2019 Annex P, immediate security
+ * processing) using HMAC-SHA256 with a truncated ICV.
+ *
+ * @author @htmlonly &copy; @endhtmlonly 2020 James Bennion-Pedley
+ *
+ * @date 1 Oct 2020
+ */
+
+#include "auth.h"
+
+#if (LWIP_PTP && LWIP_PTP_AUTH) || defined __DOXYGEN__
+
+#include <string.h>
+
+/*--------------------------------- SHA-256 ----------------------------------*/
+
+static const u32_t sha256K[64] = {
+    0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5, 0x3956c25b, 0x59f111f1, 0x923f82a4, 0xab1c5ed5,
+    0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3, 0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174,
+    0xe49b69c1, 0xefbe4786, 0x0fc19dc6, 0x240ca1cc, 0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+    0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7, 0xc6e00bf3, 0xd5a79147, 0x06ca6351, 0x14292967,
+    0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13, 0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85,
+    0xa2bfe8a1, 0xa81a664b, 0xc24b8b70, 0xc76c51a3, 0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+    0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5, 0x391c0cb3, 0x4ed8aa4a, 0x5b9cca4f, 0x682e6ff3,
+    0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208, 0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2
+};
+
+#define ROTR(x, n) (((x) >> (n)) | ((x) << (32 - (n))))
+
+/* Process one 64 octet block */
+static void sha256Block(sha256_t *ctx, const u8_t *block)
+{
+    u32_t w[64];
+    u32_t a, b, c, d, e, f, g, h, t1, t2;
+    int i;
+
+    for (i = 0; i < 16; i++) {
+        w[i] = ((u32_t)block[4 * i] << 24) | ((u32_t)block[4 * i + 1] << 16) |
+               ((u32_t)block[4 * i + 2] << 8) | ((u32_t)block[4 * i + 3]);
+    }
+
+    for (i = 16; i < 64; i++) {
+        t1 = ROTR(w[i - 2], 17) ^ ROTR(w[i - 2], 19) ^ (w[i - 2] >> 10);
+        t2 = ROTR(w[i - 15], 7) ^ ROTR(w[i - 15], 18) ^ (w[i - 15] >> 3);
+        w[i] = w[i - 16] + t2 + w[i - 7] + t1;
+    }
+
+    a = ctx->state[0]; b = ctx->state[1]; c = ctx->state[2]; d = ctx->state[3];
+    e = ctx->state[4]; f = ctx->state[5]; g = ctx->state[6]; h = ctx->state[7];
+
+    for (i = 0; i < 64; i++) {
+        t1 = h + (ROTR(e, 6) ^ ROTR(e, 11) ^ ROTR(e, 25)) + ((e & f) ^ (~e & g)) + sha256K[i] + w[i];
+        t2 = (ROTR(a, 2) ^ ROTR(a, 13) ^ ROTR(a, 22)) + ((a & b) ^ (a & c) ^ (b & c));
+        h = g; g = f; f = e; e = d + t1;
+        d = c; c = b; b = a; a = t1 + t2;
+    }
+
+    ctx->state[0] += a; ctx->state[1] += b; ctx->state[2] += c; ctx->state[3] += d;
+    ctx->state[4] += e; ctx->state[5] += f; ctx->state[6] += g; ctx->state[7] += h;
+}
+
+static void sha256Init(sha256_t *ctx)
+{
+    ctx->state[0] = 0x6a09e667; ctx->state[1] = 0xbb67ae85;
+    ctx->state[2] = 0x3c6ef372; ctx->state[3] = 0xa54ff53a;
+    ctx->state[4] = 0x510e527f; ctx->state[5] = 0x9b05688c;
+    ctx->state[6] = 0x1f83d9ab; ctx->state[7] = 0x5be0cd19;
+    ctx->length = 0;
+    ctx->blockLength = 0;
+}
+
+static void sha256Update(sha256_t *ctx, const u8_t *data, u32_t length)
+{
+    u32_t n;
+
+    ctx->length += length;
+
+    /* Complete a partially filled block first */
+    if (ctx->blockLength) {
+        n = 64 - ctx->blockLength;
+        if (n > length)
+            n = length;
+        memcpy(ctx->block + ctx->blockLength, data, n);
+        ctx->blockLength += n;
+        data += n;
+        length -= n;
+        if (ctx->blockLength < 64)
+            return;
+        sha256Block(ctx, ctx->block);
+        ctx->blockLength = 0;
+    }
+
+    /* Hash whole blocks straight from the input */
+    while (length >= 64) {
+        sha256Block(ctx, data);
+        data += 64;
+        length -= 64;
+    }
+
+    memcpy(ctx->block, data, length);
+    ctx->blockLength = length;
+}
+
+static void sha256Final(sha256_t *ctx, u8_t *digest)
+{
+    u64_t bits = ctx->length << 3;
+    int i;
+
+    ctx->block[ctx->blockLength++] = 0x80;
+    if (ctx->blockLength > 56) {
+        memset(ctx->block + ctx->blockLength, 0, 64 - ctx->blockLength);
+        sha256Block(ctx, ctx->block);
+        ctx->blockLength = 0;
+    }
+    memset(ctx->block + ctx->blockLength, 0, 56 - ctx->blockLength);
+    for (i = 0; i < 8; i++) {
+        ctx->block[63 - i] = (u8_t)(bits >> (8 * i));
+    }
+    sha256Block(ctx, ctx->block);
+
+    for (i = 0; i < 8; i++) {
+        digest[4 * i] = (u8_t)(ctx->state[i] >> 24);
+        digest[4 * i + 1] = (u8_t)(ctx->state[i] >> 16);
+        digest[4 * i + 2] = (u8_t)(ctx->state[i] >> 8);
+        digest[4 * i + 3] = (u8_t)(ctx->state[i]);
+    }
+}
+
+/*---------------------------------- HMAC ------------------------------------*/
+
+/* HMAC-SHA256 of a message, starting from the precomputed key states */
+static void hmacSha256(const authKey_t *key, const u8_t *data, u32_t length,
+                                                                u8_t *mac)
+{
+    sha256_t ctx;
+    u8_t digest[AUTH_HMAC_LENGTH];
+
+    ctx = key->inner;
+    sha256Update(&ctx, data, length);
+    sha256Final(&ctx, digest);
+
+    ctx = key->outer;
+    sha256Update(&ctx, digest, AUTH_HMAC_LENGTH);
+    sha256Final(&ctx, mac);
+}
+
+/* Constant time comparison of the ICV */
+static bool icvEqual(const u8_t *a, const u8_t *b, u8_t length)
+{
+    u8_t diff = 0;
+    u8_t i;
+
+    for (i = 0; i < length; i++) {
+        diff |= a[i] ^ b[i];
+    }
+
+    return diff == 0;
+}
+
+static authKey_t *findKey(authDS_t *auth, u32_t keyId)
+{
+    int i;
+
+    for (i = 0; i < LWIP_PTP_AUTH_MAX_KEYS; i++) {
+        if (auth->keys[i].valid && auth->keys[i].keyId == keyId) {
+            return &auth->keys[i];
+        }
+    }
+
+    return NULL;
+}
+
+/* Length of the message body preceding the first TLV (Table 36) */
+static s16_t baseLength(nibble_t messageType)
+{
+    switch (messageType) {
+        case SYNC: return SYNC_LENGTH;
+        case DELAY_REQ: return DELAY_REQ_LENGTH;
+        case PDELAY_REQ: return PDELAY_REQ_LENGTH;
+        case PDELAY_RESP: return PDELAY_RESP_LENGTH;
+        case FOLLOW_UP: return FOLLOW_UP_LENGTH;
+        case DELAY_RESP: return DELAY_RESP_LENGTH;
+        case PDELAY_RESP_FOLLOW_UP: return PDELAY_RESP_FOLLOW_UP_LENGTH;
+        case ANNOUNCE: return ANNOUNCE_LENGTH;
+        case SIGNALING: return SIGNALING_LENGTH;
+        case MANAGEMENT: return MANAGEMENT_LENGTH;
+        default: return -1;
+    }
+}
+
+/*----------------------------- Public functions -----------------------------*/
+
+/* Entry of a key-ID in a table, or a free one. NULL if the table is full */
+static authKey_t *slotKey(authKey_t *keys, u32_t keyId)
+{
+    authKey_t *entry = NULL;
+    int i;
+
+    for (i = 0; i < LWIP_PTP_AUTH_MAX_KEYS; i++) {
+        if (keys[i].valid && keys[i].keyId == keyId) {
+            return &keys[i];
+        }
+        if (!keys[i].valid && entry == NULL) {
+            entry = &keys[i];
+        }
+    }
+
+    return entry;
+}
+
+/**
+ * \brief Precompute the security association of a key-ID
+ */
+err_t authMakeKey(authKey_t *entry, u32_t keyId, const u8_t *key,
+                                        u16_t keyLength, u8_t icvLength)
+{
+    u8_t pad[64];
+    int i;
+
+    if (icvLength < AUTH_ICV_LENGTH_MIN || icvLength > AUTH_HMAC_LENGTH) {
+        return ERR_ARG;
+    }
+
+    /* Keys longer than the block size are hashed first (RFC 2104) */
+    memset(pad, 0, sizeof(pad));
+    if (keyLength > sizeof(pad)) {
+        sha256Init(&entry->inner);
+        sha256Update(&entry->inner, key, keyLength);
+        sha256Final(&entry->inner, pad);
+    }
+    else {
+        memcpy(pad, key, keyLength);
+    }
+
+    for (i = 0; i < 64; i++) pad[i] ^= 0x36;
+    sha256Init(&entry->inner);
+    sha256Update(&entry->inner, pad, sizeof(pad));
+
+    for (i = 0; i < 64; i++) pad[i] ^= 0x36 ^ 0x5c;
+    sha256Init(&entry->outer);
+    sha256Update(&entry->outer, pad, sizeof(pad));
+
+    memset(pad, 0, sizeof(pad));
+
+    entry->keyId = keyId;
+    entry->icvLength = icvLength;
+    entry->valid = true;
+
+    return ERR_OK;
+}
+
+/**
+ * \brief Install (or replace) the key for a key-ID
+ */
+err_t authSetKey(authDS_t *auth, u32_t keyId, const u8_t *key,
+                                        u16_t keyLength, u8_t icvLength)
+{
+    authKey_t *entry = slotKey(auth->keys, keyId);
+    authKey_t made;
+    err_t err;
+
+    if (entry == NULL) {
+        ERROR("authSetKey: key table full\n");
+        return ERR_MEM;
+    }
+
+    err = authMakeKey(&made, keyId, key, keyLength, icvLength);
+    if (err == ERR_OK) {
+        *entry = made;
+        DBG("authSetKey: key %u installed\n", keyId);
+    }
+
+    memset(&made, 0, sizeof(made));
+    return err;
+}
+
+/**
+ * \brief Queue a key for authInstallQueued(), replacing one queued for the
+ * same key-ID. Called under SYS_ARCH_PROTECT.
+ */
+err_t authQueueKey(authDS_t *auth, const authKey_t *key)
+{
+    authKey_t *entry = slotKey(auth->queued, key->keyId);
+
+    if (entry == NULL) {
+        return ERR_MEM;
+    }
+
+    *entry = *key;
+    return ERR_OK;
+}
+
+/**
+ * \brief Install the queued keys and empty the queue. Called by the PTP
+ * thread under SYS_ARCH_PROTECT, so no message is checked against a key
+ * half written.
+ * \return number of keys dropped for a full key table
+ */
+int authInstallQueued(authDS_t *auth)
+{
+    authKey_t *entry;
+    int i, dropped = 0;
+
+    for (i = 0; i < LWIP_PTP_AUTH_MAX_KEYS; i++) {
+        if (!auth->queued[i].valid) {
+            continue;
+        }
+
+        entry = slotKey(auth->keys, auth->queued[i].keyId);
+        if (entry != NULL) {
+            *entry = auth->queued[i];
+        }
+        else {
+            dropped++;
+        }
+        memset(&auth->queued[i], 0, sizeof(auth->queued[i]));
+    }
+
+    return dropped;
+}
+
+/**
+ * \brief Select the key used to sign outgoing messages
+ */
+err_t authSetTxKey(authDS_t *auth, u32_t keyId)
+{
+    authKey_t *entry = findKey(auth, keyId);
+
+    if (entry == NULL) {
+        return ERR_ARG;
+    }
+
+    auth->txKey = entry;
+    return ERR_OK;
+}
+
+/**
+ * \brief Append an AUTHENTICATION TLV to a packed message
+ */
+s16_t authAppendTlv(authDS_t *auth, octet_t *buf, s16_t length)
+{
+    const authKey_t *key = auth->txKey;
+    u8_t mac[AUTH_HMAC_LENGTH];
+    s16_t tlvLength;
+
+    if (key == NULL) {
+        return length;
+    }
+
+    tlvLength = AUTH_TLV_LENGTH + key->icvLength;
+    if (length + tlvLength > PACKET_SIZE) {
+        ERROR("authAppendTlv: message too long\n");
+        return length;
+    }
+
+    /* messageLength covers the TLV, so it has to be final before hashing */
+    *(s16_t*)(buf + 2) = flip16(length + tlvLength);
+
+    *(u16_t*)(buf + length) = flip16(TLV_AUTHENTICATION);
+    *(s16_t*)(buf + length + 2) = flip16(tlvLength - TLV_HEADER_LENGTH);
+    *(u8_t*)(buf + length + 4) = AUTH_SPP;
+    *(u8_t*)(buf + length + 5) = 0; /* secParamIndicator: no optional fields */
+    *(u32_t*)(buf + length + 6) = flip32(key->keyId);
+
+    /* ICV covers the whole message up to the ICV field itself */
+    hmacSha256(key, (const u8_t *)buf, length + AUTH_TLV_LENGTH, mac);
+    memcpy(buf + length + AUTH_TLV_LENGTH, mac, key->icvLength);
+
+    return length + tlvLength;
+}
+
+/**
+ * \brief Verify the AUTHENTICATION TLV of a received message
+ */
+bool authVerify(authDS_t *auth, const octet_t *buf, ssize_t length,
+                                                const msgHeader_t *header)
+{
+    const authKey_t *key;
+    u8_t mac[AUTH_HMAC_LENGTH];
+    int offset, tlvLength, messageLength;
+    u16_t tlvType;
+    int i;
+
+    /* Authentication is only enforced once a key has been installed */
+    for (i = 0; i < LWIP_PTP_AUTH_MAX_KEYS; i++) {
+        if (auth->keys[i].valid)
+            break;
+    }
+    if (i == LWIP_PTP_AUTH_MAX_KEYS) {
+        return true;
+    }
+
+    /* Walk in int: a lengthField near 0x7FFF must not wrap the offset */
+    offset = baseLength(header->messageType);
+    messageLength = (u16_t)header->messageLength;
+    if (offset < 0 || messageLength > length || messageLength > PACKET_SIZE) {
+        auth->rxMissingTlv++;
+        return false;
+    }
+
+    /* The AUTHENTICATION TLV must be the last TLV of the message */
+    for (;;) {
+        if (offset + AUTH_TLV_LENGTH > messageLength) {
+            DBGV("authVerify: no authentication TLV\n");
+            auth->rxMissingTlv++;
+            return false;
+        }
+
+        tlvType = flip16(*(u16_t*)(buf + offset));
+        tlvLength = (u16_t)flip16(*(u16_t*)(buf + offset + 2));
+
+        if (tlvLength > messageLength - offset - TLV_HEADER_LENGTH) {
+            DBGV("authVerify: TLV beyond the end of the message\n");
+            auth->rxMissingTlv++;
+            return false;
+        }
+
+        if (tlvType == TLV_AUTHENTICATION)
+            break;
+
+        offset += TLV_HEADER_LENGTH + tlvLength;
+    }
+
+    if (*(u8_t*)(buf + offset + 4) != AUTH_SPP || *(u8_t*)(buf + offset + 5) != 0) {
+        DBGV("authVerify: unsupported security parameters\n");
+        auth->rxUnknownKey++;
+        return false;
+    }
+
+    key = findKey(auth, flip32(*(u32_t*)(buf + offset + 6)));
+    if (key == NULL) {
+        DBGV("authVerify: unknown key\n");
+        auth->rxUnknownKey++;
+        return false;
+    }
+
+    if (offset + TLV_HEADER_LENGTH + tlvLength != messageLength ||
+            tlvLength != AUTH_TLV_LENGTH - TLV_HEADER_LENGTH + key->icvLength) {
+        DBGV("authVerify: malformed authentication TLV\n");
+        auth->rxBadIcv++;
+        return false;
+    }
+
+    hmacSha256(key, (const u8_t *)buf, offset + AUTH_TLV_LENGTH, mac);
+    if (!icvEqual(mac, (const u8_t *)(buf + offset + AUTH_TLV_LENGTH), key->icvLength)) {
+        DBGV("authVerify: ICV mismatch\n");
+        auth->rxBadIcv++;
+        return false;
+    }
+
+    auth->rxAuthenticated++;
+    return true;
+}
+
+#endif /* (LWIP_PTP && LWIP_PTP_AUTH) || defined __DOXYGEN__ */
@@ -0,0 +1,63 @@
+#ifndef __LWIP_PTP_AUTH_H__
+#define __LWIP_PTP_AUTH_H__
+
+/**
+ * @file
+ * @brief ptpd-lwip authentication TLV (IEEE 1588-2019 Annex P)
+ *
+ * @author @htmlonly &copy; @endhtmlonly 2020 James Bennion-Pedley
+ *
+ * @date 1 Oct 2020
+ */
+
+#include "def/datatypes_private.h"
+
+#if LWIP_PTP_AUTH
+
+/**
+ * \brief Precompute the security association of a key-ID. The HMAC inner and
+ * outer states are computed here so that per-message cost is the message
+ * hash plus a single block for the outer hash.
+ */
+err_t authMakeKey(authKey_t *entry, u32_t keyId, const u8_t *key,
+                                        u16_t keyLength, u8_t icvLength);
+
+/**
+ * \brief Install (or replace) the key for a key-ID, from the thread that
+ * checks the messages
+ */
+err_t authSetKey(authDS_t *auth, u32_t keyId, const u8_t *key,
+                                        u16_t keyLength, u8_t icvLength);
+
+/**
+ * \brief Queue a key made by authMakeKey() for the PTP thread to install
+ */
+err_t authQueueKey(authDS_t *auth, const authKey_t *key);
+
+/**
+ * \brief Install the queued keys
+ * \return number of keys dropped for a full key table
+ */
+int authInstallQueued(authDS_t *auth);
+
+/**
+ * \brief Select the key used to sign outgoing messages
+ */
+err_t authSetTxKey(authDS_t *auth, u32_t keyId);
+
+/**
+ * \brief Append an AUTHENTICATION TLV to a packed message of 'length' octets
+ * and fix up messageLength. Returns the new length of the message.
+ */
+s16_t authAppendTlv(authDS_t *auth, octet_t *buf, s16_t length);
+
+/**
+ * \brief Verify the AUTHENTICATION TLV of a received message
+ * \return true if the message may be processed
+ */
+bool authVerify(authDS_t *auth, const octet_t *buf, ssize_t length,
+                                                const msgHeader_t *header);
+
+#endif /* LWIP_PTP_AUTH */
+
+#endif /* __LWIP_PTP_AUTH_H__ */
@@ -6,6 +6,13 @@
 
 #include <string.h>
 
+#include <lwip/sys.h>
+
+static void bmcRank(ptpClock_t *ptpClock, s16_t i, bool changed, u32_t now);
+static void bmcRescan(ptpClock_t *ptpClock, u32_t now);
+static s8_t bmcDataSetComparison(const foreignMasterRecord_t *A, const foreignMasterRecord_t *B,
+                                                                ptpClock_t *ptpClock);
+
 /* Convert EUI48 format to EUI64 */
 static void EUI48toEUI64(const octet_t * eui48, octet_t * eui64)
 {
@@ -63,6 +70,7 @@ void initData(ptpClock_t *ptpClock)
     ptpClock->portDS.portIdentity.portNumber = NUMBER_PORTS;
     ptpClock->portDS.logMinDelayReqInterval = DEFAULT_DELAYREQ_INTERVAL;
     ptpClock->portDS.peerMeanPathDelay.seconds = ptpClock->portDS.peerMeanPathDelay.nanoseconds = 0;
+    ptpClock->portDS.delayAsymmetry = rtOpts->delayAsymmetry;
     ptpClock->portDS.logAnnounceInterval = rtOpts->announceInterval;
     ptpClock->portDS.announceReceiptTimeout = DEFAULT_ANNOUNCE_RECEIPT_TIMEOUT;
     ptpClock->portDS.logSyncInterval = rtOpts->syncInterval;
@@ -71,16 +79,26 @@ void initData(ptpClock_t *ptpClock)
     ptpClock->portDS.versionNumber = VERSION_PTP;
 
     /* Init other stuff */
-    ptpClock->foreignMasterDS.count = 0;
     ptpClock->foreignMasterDS.capacity = rtOpts->maxForeignRecords;
+    foreignClear(ptpClock);
 
     ptpClock->inboundLatency = rtOpts->inboundLatency;
     ptpClock->outboundLatency = rtOpts->outboundLatency;
 
+    ptpClock->servo.type = rtOpts->servo.type;
+    ptpClock->servo.syntonizeOnly = rtOpts->servo.syntonizeOnly;
     ptpClock->servo.sDelay = rtOpts->servo.sDelay;
     ptpClock->servo.sOffset = rtOpts->servo.sOffset;
     ptpClock->servo.ai = rtOpts->servo.ai;
     ptpClock->servo.ap = rtOpts->servo.ap;
+    ptpClock->servo.gainSteps = rtOpts->servo.gainSteps;
+    ptpClock->servo.maxSlew = rtOpts->servo.maxSlew;
+    ptpClock->servo.holdoverAging = rtOpts->servo.holdoverAging;
+    ptpClock->servo.acquireSamples = rtOpts->servo.acquireSamples;
+    ptpClock->servo.delayWindow = rtOpts->servo.delayWindow;
+    ptpClock->servo.qPhase = rtOpts->servo.qPhase;
+    ptpClock->servo.qFreq = rtOpts->servo.qFreq;
+    ptpClock->servo.r = rtOpts->servo.r;
     ptpClock->servo.noAdjust = rtOpts->servo.noAdjust;
     ptpClock->servo.noResetClock = rtOpts->servo.noResetClock;
 
@@ -96,53 +114,331 @@ bool isSamePortIdentity(const portIdentity_t *A, const portIdentity_t *B)
                     CLOCK_IDENTITY_LENGTH) && (A->portNumber == B->portNumber));
 }
 
+/* Pack the dataset fields of 9.3.4 figure 27 big-endian in order of
+ * precedence into 128 bits, so the better of two grandmasters has the
+ * smaller key. The identity comes last and breaks ties: its first two
+ * octets end key[0], the other six fill the low bits of key[1]. */
+static void bmcKey(u64_t *key, const msgAnnounce_t *announce)
+{
+    const octet_t *id = announce->grandmasterIdentity;
+
+    key[0] = (u64_t)announce->grandmasterPriority1 << 56 |
+            (u64_t)announce->grandmasterClockQuality.clockClass << 48 |
+            (u64_t)announce->grandmasterClockQuality.clockAccuracy << 40 |
+            (u64_t)(u16_t)announce->grandmasterClockQuality.offsetScaledLogVariance << 24 |
+            (u64_t)announce->grandmasterPriority2 << 16 |
+            (u64_t)id[0] << 8 | id[1];
+    key[1] = (u64_t)id[2] << 40 | (u64_t)id[3] << 32 | (u64_t)id[4] << 24 |
+            (u64_t)id[5] << 16 | (u64_t)id[6] << 8 | id[7];
+}
+
+/* Hash bucket of a port identity, FNV-1a */
+static s16_t foreignHash(const foreignMasterDS_t *ds, const portIdentity_t *portIdentity)
+{
+    u32_t hash = 2166136261u;
+    int k;
+
+    for (k = 0; k < CLOCK_IDENTITY_LENGTH; k++)
+        hash = (hash ^ portIdentity->clockIdentity[k]) * 16777619u;
+    hash = (hash ^ ((u16_t)portIdentity->portNumber & 0xFF)) * 16777619u;
+    hash = (hash ^ ((u16_t)portIdentity->portNumber >> 8)) * 16777619u;
+
+    return (s16_t)(hash % (u32_t)ds->capacity);
+}
+
+/* Index of the record of a port identity, -1 if unknown */
+static s16_t foreignFind(const foreignMasterDS_t *ds, const portIdentity_t *portIdentity)
+{
+    s16_t i;
+
+    for (i = ds->buckets[foreignHash(ds, portIdentity)]; i >= 0; i = ds->records[i].hashNext) {
+        if (isSamePortIdentity(portIdentity, &ds->records[i].foreignMasterPortIdentity))
+            return i;
+    }
+
+    return -1;
+}
+
+/* Take a record off the list ordered by the last Announce */
+static void foreignUnlink(foreignMasterDS_t *ds, s16_t i)
+{
+    foreignMasterRecord_t *rec = &ds->records[i];
+
+    if (rec->newer >= 0)
+        ds->records[rec->newer].older = rec->older;
+    else
+        ds->newest = rec->older;
+
+    if (rec->older >= 0)
+        ds->records[rec->older].newer = rec->newer;
+    else
+        ds->oldest = rec->newer;
+}
+
+/* Put a record at the newest end of the list */
+static void foreignLinkNewest(foreignMasterDS_t *ds, s16_t i)
+{
+    ds->records[i].newer = -1;
+    ds->records[i].older = ds->newest;
+
+    if (ds->newest >= 0)
+        ds->records[ds->newest].newer = i;
+    else
+        ds->oldest = i;
+
+    ds->newest = i;
+}
+
+/* Unhash a record and return it to the free list */
+static void foreignRemove(foreignMasterDS_t *ds, s16_t i)
+{
+    s16_t *link;
+
+    link = &ds->buckets[foreignHash(ds, &ds->records[i].foreignMasterPortIdentity)];
+    while (*link != i)
+        link = &ds->records[*link].hashNext;
+    *link = ds->records[i].hashNext;
+
+    foreignUnlink(ds, i);
+    if (ds->records[i].syncFault)
+        ds->syncFaults--;
+    ds->records[i].hashNext = ds->free;
+    ds->free = i;
+    ds->count--;
+
+    /* The runner-up may be any of the others now */
+    if (ds->best == i || ds->second == i) {
+        ds->best = ds->second = -1;
+        ds->rescan = true;
+    }
+}
+
+/* Announce interval of a foreign master in ms, ours if it advertises none */
+static u32_t foreignInterval(const ptpClock_t *ptpClock, const foreignMasterRecord_t *rec)
+{
+    s8_t logInterval = rec->header.logMessageInterval;
+
+    if (logInterval < LOG_INTERVAL_MIN || logInterval > LOG_INTERVAL_MAX)
+        logInterval = ptpClock->portDS.logAnnounceInterval;
+
+    return pow2ms(logInterval);
+}
+
+/* 9.3.2.5: DEFAULT_FOREIGN_MASTER_THRESHOLD distinct Announce messages
+ * within DEFAULT_FOREIGN_MASTER_TIME_WINDOW announce intervals, and Syncs
+ * if it stopped sending them as the parent */
+static bool foreignQualified(const ptpClock_t *ptpClock, const foreignMasterRecord_t *rec, u32_t now)
+{
+    return !rec->syncFault &&
+            rec->foreignMasterAnnounceMessages >= DEFAULT_FOREIGN_MASTER_THRESHOLD &&
+            now - rec->received[0] <= DEFAULT_FOREIGN_MASTER_TIME_WINDOW * foreignInterval(ptpClock, rec);
+}
+
+/* Drop the masters silent for announceReceiptTimeout of their announce
+ * intervals. The list is ordered by the last Announce, so this stops at the
+ * first one still alive and a long interval may hold the others back a bit */
+static void foreignAge(ptpClock_t *ptpClock, u32_t now)
+{
+    foreignMasterDS_t *ds = &ptpClock->foreignMasterDS;
+    foreignMasterRecord_t *rec;
+
+    while (ds->oldest >= 0) {
+        rec = &ds->records[ds->oldest];
+        if (now - rec->received[DEFAULT_FOREIGN_MASTER_THRESHOLD - 1] <
+                    ptpClock->portDS.announceReceiptTimeout * foreignInterval(ptpClock, rec))
+            break;
+
+        DBGV("foreignAge: foreign master %d aged out\n", ds->oldest);
+        foreignRemove(ds, ds->oldest);
+    }
+}
+
+/* Record to give up for a new master when the table is full: the worst
+ * ranked of the unqualified, else of the qualified. The parent, the best and
+ * the runner-up are kept, and the better masters keep their records long
+ * enough to qualify, so only the worst ones churn through a full table. A
+ * sync-faulted record counts as qualified, or its next Announce would bring
+ * it back without the fault. -1 if only the kept ones are left */
+static s16_t foreignVictim(ptpClock_t *ptpClock, u32_t now)
+{
+    foreignMasterDS_t *ds = &ptpClock->foreignMasterDS;
+    s16_t i, parent, victim = -1;
+    bool qualified, victimQualified = true;
+
+    if (ds->rescan)
+        bmcRescan(ptpClock, now);
+
+    parent = foreignFind(ds, &ptpClock->parentDS.parentPortIdentity);
+
+    for (i = ds->oldest; i >= 0; i = ds->records[i].newer) {
+        if (i == ds->best || i == ds->second || i == parent)
+            continue;
+
+        qualified = ds->records[i].syncFault || foreignQualified(ptpClock, &ds->records[i], now);
+        if (victim < 0 || (victimQualified && !qualified) || (victimQualified == qualified &&
+                bmcDataSetComparison(&ds->records[i], &ds->records[victim], ptpClock) < 0)) {
+            victim = i;
+            victimQualified = qualified;
+        }
+    }
+
+    return victim;
+}
+
+/**
+ * \brief Forget all foreign masters
+ */
+void foreignClear(ptpClock_t *ptpClock)
+{
+    foreignMasterDS_t *ds = &ptpClock->foreignMasterDS;
+    s16_t i;
+
+    ds->count = 0;
+    ds->syncFaults = 0;
+    ds->best = ds->second = -1;
+    ds->rescan = false;
+    ds->changed = true;
+    ds->newest = ds->oldest = -1;
+    ds->free = -1;
+
+    for (i = ds->capacity - 1; i >= 0; i--) {
+        ds->buckets[i] = -1;
+        ds->records[i].hashNext = ds->free;
+        ds->free = i;
+    }
+}
+
+/**
+ * \brief Forget one foreign master
+ */
+void foreignForget(ptpClock_t *ptpClock, const portIdentity_t *portIdentity)
+{
+    s16_t i = foreignFind(&ptpClock->foreignMasterDS, portIdentity);
+
+    if (i >= 0)
+        foreignRemove(&ptpClock->foreignMasterDS, i);
+}
+
+/**
+ * \brief Whether a foreign master is marked for its Syncs stopping
+ */
+bool foreignSyncFaulted(const ptpClock_t *ptpClock, const portIdentity_t *portIdentity)
+{
+    s16_t i = foreignFind(&ptpClock->foreignMasterDS, portIdentity);
+
+    return i >= 0 && ptpClock->foreignMasterDS.records[i].syncFault;
+}
+
+/**
+ * \brief Mark a foreign master whose Syncs stopped, or clear the mark once
+ * they come back. A marked master keeps its record but does not qualify
+ * \return whether the mark changed
+ */
+bool foreignSyncFault(ptpClock_t *ptpClock, const portIdentity_t *portIdentity, bool fault)
+{
+    foreignMasterDS_t *ds = &ptpClock->foreignMasterDS;
+    s16_t i = foreignFind(ds, portIdentity);
+
+    if (i < 0 || ds->records[i].syncFault == fault)
+        return false;
+
+    ds->records[i].syncFault = fault;
+    if (fault) {
+        ds->syncFaults++;
+        if (ds->best == i || ds->second == i) {
+            ds->best = ds->second = -1;
+            ds->rescan = true;
+        }
+    }
+    else {
+        ds->syncFaults--;
+        bmcRank(ptpClock, i, true, sys_now());
+    }
+
+    return true;
+}
+
 /**
  * \brief Add foreign record defined by announce message
  */
 void addForeign(ptpClock_t *ptpClock, const msgHeader_t *header,
                                                 const msgAnnounce_t *announce)
 {
-    int i, j;
-    bool found = false;
-
-    j = ptpClock->foreignMasterDS.best;
-
-    /* Check if Foreign master is already known */
-    for (i = 0; i < ptpClock->foreignMasterDS.count; i++) {
-        if (isSamePortIdentity(&header->sourcePortIdentity,
-                &ptpClock->foreignMasterDS.records[j].foreignMasterPortIdentity)) {
-            /* Foreign Master is already in Foreignmaster data set */
-            ptpClock->foreignMasterDS.records[j].foreignMasterAnnounceMessages++;
-            found = false;
-            DBGV("addForeign: AnnounceMessage incremented \n");
-            ptpClock->foreignMasterDS.records[j].header = *header;
-            ptpClock->foreignMasterDS.records[j].announce = *announce;
-            break;
+    foreignMasterDS_t *ds = &ptpClock->foreignMasterDS;
+    foreignMasterRecord_t *rec;
+    u32_t now = sys_now();
+    u64_t key[2];
+    bool changed;
+    s16_t i, *bucket;
+    int k;
+
+    /* 9.3.2.5 d, the path to the grandmaster is too long */
+    if (announce->stepsRemoved >= 255) {
+        DBGV("addForeign: stepsRemoved %d, ignored\n", announce->stepsRemoved);
+        return;
+    }
+
+    i = foreignFind(ds, &header->sourcePortIdentity);
+    bmcKey(key, announce);
+
+    if (i >= 0) {
+        /* Foreign Master is already in Foreignmaster data set */
+        rec = &ds->records[i];
+        if (rec->header.sequenceId == header->sequenceId) {
+            DBGV("addForeign: duplicate Announce ignored\n");
+            return;
         }
 
-        j = (j + 1) % ptpClock->foreignMasterDS.count;
-    }
+        /* Most Announce messages repeat the last one */
+        changed = rec->key[0] != key[0] || rec->key[1] != key[1] ||
+                rec->announce.stepsRemoved != announce->stepsRemoved;
 
-    /* New Foreign Master */
-    if (!found) {
-        if (ptpClock->foreignMasterDS.count < ptpClock->foreignMasterDS.capacity) {
-            ptpClock->foreignMasterDS.count++;
+        if (rec->foreignMasterAnnounceMessages < DEFAULT_FOREIGN_MASTER_THRESHOLD)
+            rec->foreignMasterAnnounceMessages++;
+        foreignUnlink(ds, i);
+        DBGV("addForeign: AnnounceMessage incremented \n");
+    }
+    else {
+        /* New Foreign Master, in place of the least useful one if full */
+        if (ds->free < 0) {
+            i = foreignVictim(ptpClock, now);
+            if (i < 0) {
+                DBGV("addForeign: table full, new foreign master ignored\n");
+                return;
+            }
+            foreignRemove(ds, i);
         }
 
-        j = ptpClock->foreignMasterDS.i;
+        i = ds->free;
+        rec = &ds->records[i];
+        ds->free = rec->hashNext;
 
-        /* Copy new foreign master data set from Announce message */
-        memcpy(ptpClock->foreignMasterDS.records[j].foreignMasterPortIdentity.clockIdentity, header->sourcePortIdentity.clockIdentity, CLOCK_IDENTITY_LENGTH);
-        ptpClock->foreignMasterDS.records[j].foreignMasterPortIdentity.portNumber = header->sourcePortIdentity.portNumber;
-        ptpClock->foreignMasterDS.records[j].foreignMasterAnnounceMessages = 0;
+        bucket = &ds->buckets[foreignHash(ds, &header->sourcePortIdentity)];
+        rec->hashNext = *bucket;
+        *bucket = i;
+        ds->count++;
 
-        /* Header and announce field of each Foreign Master are usefull to run Best Master Clock Algorithm */
-        ptpClock->foreignMasterDS.records[j].header = *header;
-        ptpClock->foreignMasterDS.records[j].announce = *announce;
+        /* Copy new foreign master data set from Announce message */
+        memcpy(rec->foreignMasterPortIdentity.clockIdentity, header->sourcePortIdentity.clockIdentity, CLOCK_IDENTITY_LENGTH);
+        rec->foreignMasterPortIdentity.portNumber = header->sourcePortIdentity.portNumber;
+        rec->foreignMasterAnnounceMessages = 1;
+        rec->syncFault = false;
+        changed = true;
         DBGV("addForeign: New foreign Master added \n");
-
-        ptpClock->foreignMasterDS.i = (ptpClock->foreignMasterDS.i + 1) % ptpClock->foreignMasterDS.capacity;
     }
+
+    for (k = 1; k < DEFAULT_FOREIGN_MASTER_THRESHOLD; k++)
+        rec->received[k - 1] = rec->received[k];
+    rec->received[DEFAULT_FOREIGN_MASTER_THRESHOLD - 1] = now;
+    foreignLinkNewest(ds, i);
+
+    /* Header and announce field of each Foreign Master are usefull to run Best Master Clock Algorithm */
+    rec->header = *header;
+    rec->announce = *announce;
+    rec->key[0] = key[0];
+    rec->key[1] = key[1];
+
+    bmcRank(ptpClock, i, changed, now);
 }
 
 
@@ -258,46 +554,24 @@ static void copyD0(msgHeader_t *header, msgAnnounce_t *announce, ptpClock_t *ptp
 #define ERROR_2 -0
 
 
-#define COMPARE_AB_RETURN_BETTER(cond, msg)                             \
-    if ((announceA->cond) > (announceB->cond)) {                           \
-        DBGVV("bmcDataSetComparison: " msg ": B better then A\n");          \
-        return B_better_then_A;                                             \
-    }                                                                     \
-    if ((announceB->cond) > (announceA->cond)) {                           \
-        DBGVV("bmcDataSetComparison: " msg ": A better then B\n");          \
-        return A_better_then_B;                                             \
-    }                                                                     \
-
 /* Data set comparison bewteen two foreign masters (9.3.4 fig 27) return similar to memcmp() */
-static s8_t bmcDataSetComparison(msgHeader_t *headerA, msgAnnounce_t *announceA,
-                msgHeader_t *headerB, msgAnnounce_t *announceB, ptpClock_t *ptpClock)
+static s8_t bmcDataSetComparison(const foreignMasterRecord_t *A, const foreignMasterRecord_t *B,
+                                                                ptpClock_t *ptpClock)
 {
-    int grandmasterIdentityComp;
-    short comp = 0;
+    const msgHeader_t *headerA = &A->header, *headerB = &B->header;
+    const msgAnnounce_t *announceA = &A->announce, *announceB = &B->announce;
+    int comp;
 
     DBGV("bmcDataSetComparison\n");
-    /* Identity comparison */
-
-    /* GM identity of A == GM identity of B */
-    /* TODO: zkontrolovat memcmp, co vraci za vysledky !*/
-    grandmasterIdentityComp = memcmp(announceA->grandmasterIdentity, announceB->grandmasterIdentity, CLOCK_IDENTITY_LENGTH);
-
-    if (0 != grandmasterIdentityComp) {
-        /* Algoritgm part 1 - Figure 27 */
-        COMPARE_AB_RETURN_BETTER(grandmasterPriority1,"grandmaster.Priority1");
-        COMPARE_AB_RETURN_BETTER(grandmasterClockQuality.clockClass,"grandmaster.clockClass");
-        COMPARE_AB_RETURN_BETTER(grandmasterClockQuality.clockAccuracy,"grandmaster.clockAccuracy");
-        COMPARE_AB_RETURN_BETTER(grandmasterClockQuality.offsetScaledLogVariance,"grandmaster.Variance");
-        COMPARE_AB_RETURN_BETTER(grandmasterPriority2,"grandmaster.Priority2");
-
-        if (grandmasterIdentityComp > 0) {
-            DBGVV("bmcDataSetComparison: grandmaster.Identity: B better then A\n");
+
+    /* Algoritgm part 1 - Figure 27, unless both have the same grandmaster */
+    if (((A->key[0] ^ B->key[0]) & 0xFFFF) != 0 || A->key[1] != B->key[1]) {
+        if (A->key[0] > B->key[0] || (A->key[0] == B->key[0] && A->key[1] > B->key[1])) {
+            DBGVV("bmcDataSetComparison: grandmaster: B better then A\n");
             return B_better_then_A;
         }
-        else if (grandmasterIdentityComp < 0) {
-            DBGVV("bmcDataSetComparison: grandmaster.Identity: A better then B\n");
-            return A_better_then_B;
-        }
+        DBGVV("bmcDataSetComparison: grandmaster: A better then B\n");
+        return A_better_then_B;
     }
 
     /* Algoritgm part 2 - Figure 28 */
@@ -365,17 +639,12 @@ static s8_t bmcDataSetComparison(msgHeader_t *headerA, msgAnnounce_t *announceA,
 }
 
 /* State decision algorithm 9.3.3 Fig 26 */
-static u8_t bmcStateDecision(msgHeader_t *header, msgAnnounce_t *announce, ptpClock_t *ptpClock)
+static u8_t bmcStateDecision(const foreignMasterRecord_t *d0, const foreignMasterRecord_t *best,
+                                                                ptpClock_t *ptpClock)
 {
     int comp;
 
-    if ((!ptpClock->foreignMasterDS.count) && (ptpClock->portDS.portState == PTP_LISTENING)) {
-        return PTP_LISTENING;
-    }
-
-    copyD0(&ptpClock->msgTmpHeader, &ptpClock->msgTmp.announce, ptpClock);
-
-    comp = bmcDataSetComparison(&ptpClock->msgTmpHeader, &ptpClock->msgTmp.announce, header, announce, ptpClock);
+    comp = bmcDataSetComparison(d0, best, ptpClock);
 
     DBGV("bmcStateDecision: %d\n", comp);
 
@@ -395,32 +664,130 @@ static u8_t bmcStateDecision(msgHeader_t *header, msgAnnounce_t *announce, ptpCl
             return PTP_MASTER;
         }
         else {
-            s1(ptpClock, header, announce);
+            s1(ptpClock, &best->header, &best->announce);
             return PTP_SLAVE;
         }
     }
 }
 
+/* Keep the best record and the runner-up up to date after record i was
+ * updated. A new or better record only has to beat them, but a change to
+ * one of them may reorder the others, so that takes a rescan */
+static void bmcRank(ptpClock_t *ptpClock, s16_t i, bool changed, u32_t now)
+{
+    foreignMasterDS_t *ds = &ptpClock->foreignMasterDS;
+
+    if (ds->rescan)
+        return;
+
+    if (i == ds->best || i == ds->second) {
+        if (changed)
+            ds->rescan = true;
+        return;
+    }
+
+    if (!foreignQualified(ptpClock, &ds->records[i], now))
+        return;
+
+    if (ds->best < 0 || bmcDataSetComparison(&ds->records[i], &ds->records[ds->best], ptpClock) > 0) {
+        ds->second = ds->best;
+        ds->best = i;
+        ds->changed = true;
+    }
+    else if (ds->second < 0 || bmcDataSetComparison(&ds->records[i], &ds->records[ds->second], ptpClock) > 0) {
+        ds->second = i;
+    }
+}
+
+/* Erbest and the runner-up among all the qualified foreign masters (9.3.2.5) */
+static void bmcRescan(ptpClock_t *ptpClock, u32_t now)
+{
+    foreignMasterDS_t *ds = &ptpClock->foreignMasterDS;
+    s16_t i;
+
+    ds->rescans++;
+    ds->rescan = false;
+    ds->changed = true;
+    ds->best = ds->second = -1;
+
+    for (i = ds->newest; i >= 0; i = ds->records[i].older)
+        bmcRank(ptpClock, i, false, now);
+}
+
 /**
  * \brief Compare data set of foreign masters and local data set
  * \return The recommended state for the port
  */
 u8_t bmc(ptpClock_t *ptpClock)
 {
-    s16_t i, best;
-
-    /* Starting from i = 1, not necessery to test record[i = 0] against record[best = 0] -> they are the same */
-    for (i = 1, best = 0; i < ptpClock->foreignMasterDS.count; i++) {
-        if ((bmcDataSetComparison(&ptpClock->foreignMasterDS.records[i].header, &ptpClock->foreignMasterDS.records[i].announce,
-                    &ptpClock->foreignMasterDS.records[best].header, &ptpClock->foreignMasterDS.records[best].announce, ptpClock)) < 0) {
-            best = i;
+    foreignMasterDS_t *ds = &ptpClock->foreignMasterDS;
+    foreignMasterRecord_t d0;
+    u32_t now = sys_now();
+
+    ds->events++;
+    foreignAge(ptpClock, now);
+
+    /* Masters also drop out when they fall silent for the window */
+    if ((ds->best >= 0 && !foreignQualified(ptpClock, &ds->records[ds->best], now)) ||
+            (ds->second >= 0 && !foreignQualified(ptpClock, &ds->records[ds->second], now)))
+        ds->rescan = true;
+
+    if (ds->rescan)
+        bmcRescan(ptpClock, now);
+
+    copyD0(&d0.header, &d0.announce, ptpClock);
+    bmcKey(d0.key, &d0.announce);
+
+    /* Same ranking, same local dataset and same state: same decision */
+    if (!ds->changed && ds->decisionState == ptpClock->portDS.portState &&
+            ds->localKey[0] == d0.key[0] && ds->localKey[1] == d0.key[1])
+        return ds->decision;
+
+    DBGV("bmc: best record %d, runner-up %d\n", ds->best, ds->second);
+    ds->decisions++;
+    ds->changed = false;
+    ds->decisionState = ptpClock->portDS.portState;
+    ds->localKey[0] = d0.key[0];
+    ds->localKey[1] = d0.key[1];
+
+    /* Nobody qualified: keep listening, and keep the parent until the
+     * announce receipt timeout decides it is gone */
+    if (ds->best < 0) {
+        switch (ptpClock->portDS.portState) {
+            case PTP_LISTENING:
+                ds->decision = PTP_LISTENING;
+                break;
+
+            case PTP_UNCALIBRATED:
+            case PTP_SLAVE:
+                ds->decision = PTP_SLAVE;
+                break;
+
+            default:
+                m1(ptpClock);
+                ds->decision = PTP_MASTER;
+                break;
         }
     }
+    else {
+        ds->decision = bmcStateDecision(&d0, &ds->records[ds->best], ptpClock);
+    }
+
+    return ds->decision;
+}
+
+/**
+ * \brief Port identity of the second best qualified foreign master
+ * \return NULL if there is none
+ */
+const portIdentity_t *bmcRunnerUp(const ptpClock_t *ptpClock)
+{
+    const foreignMasterDS_t *ds = &ptpClock->foreignMasterDS;
 
-    DBGV("bmc: best record %d\n", best);
-    ptpClock->foreignMasterDS.best = best;
+    if (ds->second < 0)
+        return NULL;
 
-    return bmcStateDecision(&ptpClock->foreignMasterDS.records[best].header, &ptpClock->foreignMasterDS.records[best].announce, ptpClock);
+    return &ds->records[ds->second].foreignMasterPortIdentity;
 }
 
 #endif /* LWIP_PTP || defined __DOXYGEN__ */
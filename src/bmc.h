@@ -22,6 +22,26 @@ void initData(ptpClock_t *ptpClock);
  */
 bool isSamePortIdentity(const portIdentity_t *A, const portIdentity_t *B);
 
+/**
+ * \brief Forget all foreign masters
+ */
+void foreignClear(ptpClock_t *ptpClock);
+
+/**
+ * \brief Forget one foreign master
+ */
+void foreignForget(ptpClock_t *ptpClock, const portIdentity_t *portIdentity);
+
+/**
+ * \brief Whether a foreign master is marked for its Syncs stopping
+ */
+bool foreignSyncFaulted(const ptpClock_t *ptpClock, const portIdentity_t *portIdentity);
+
+/**
+ * \brief Mark a foreign master whose Syncs stopped, or clear the mark
+ */
+bool foreignSyncFault(ptpClock_t *ptpClock, const portIdentity_t *portIdentity, bool fault);
+
 /**
  * \brief Add foreign record defined by announce message
  */
@@ -54,4 +74,10 @@ void s1(ptpClock_t *ptpClock, const msgHeader_t *header,
  */
 u8_t bmc(ptpClock_t *ptpClock);
 
+/**
+ * \brief Port identity of the second best qualified foreign master
+ * \return NULL if there is none
+ */
+const portIdentity_t *bmcRunnerUp(const ptpClock_t *ptpClock);
+
 #endif /* __LWIP_PTP_BMC_H__ */
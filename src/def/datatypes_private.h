@@ -239,11 +239,16 @@ typedef struct {
 
 typedef struct {
     portIdentity_t foreignMasterPortIdentity;
-    s16_t foreignMasterAnnounceMessages;
+    s16_t foreignMasterAnnounceMessages; /**< saturates at DEFAULT_FOREIGN_MASTER_THRESHOLD */
 
     /* This one is not in the spec */
     msgAnnounce_t announce;
     msgHeader_t header;
+    u64_t key[2]; /**< packed 9.3.4 figure 27 fields, smaller is better */
+    u32_t received[DEFAULT_FOREIGN_MASTER_THRESHOLD]; /**< sys_now() of the last Announce messages, oldest first */
+    s16_t hashNext; /**< next record in the same hash bucket, or in the free list */
+    s16_t newer, older; /**< neighbours in the list ordered by the last Announce */
+    bool syncFault; /**< its Syncs stopped while it was the parent, not qualified until they come back */
 } foreignMasterRecord_t;
 
 /**
@@ -321,6 +326,7 @@ typedef struct {
     u8_t portState;
     s8_t logMinDelayReqInterval; /**< spec 7.7.2.4 */
     timeInternal_t peerMeanPathDelay;
+    timeInternal_t delayAsymmetry; /**< spec 7.4.2, master to slave delay minus the mean */
     s8_t logAnnounceInterval; /**< spec 7.7.2.2 */
     u8_t announceReceiptTimeout; /**< spec 7.7.3.1 */
     s8_t logSyncInterval; /**< spec 7.7.2.3 */
@@ -337,12 +343,26 @@ typedef struct {
 
 typedef struct {
     foreignMasterRecord_t* records;
+    s16_t* buckets; /**< first record of each hash chain, capacity entries */
 
     /* Other things we need for the protocol */
     s16_t count;
     s16_t capacity;
-    s16_t i;
-    s16_t best;
+    s16_t best; /**< -1 if no record is qualified */
+    s16_t second; /**< runner-up, -1 if fewer than two are qualified */
+    s16_t newest, oldest; /**< ends of the list ordered by the last Announce */
+    s16_t free; /**< first unused record */
+    s16_t syncFaults; /**< records with syncFault set */
+
+    /* Incremental BMC */
+    bool rescan; /**< best or second has to be found again among all records */
+    bool changed; /**< the ranking changed since the last state decision */
+    u8_t decision; /**< recommended state of the last state decision */
+    u8_t decisionState; /**< port state at the last state decision */
+    u64_t localKey[2]; /**< defaultDS key at the last state decision */
+    u32_t events; /**< state decision events */
+    u32_t decisions; /**< state decisions actually run */
+    u32_t rescans; /**< full rescans of the records */
 } foreignMasterDS_t;
 
 /**
@@ -351,11 +371,20 @@ typedef struct {
  */
 
 typedef struct {
+    u8_t type; /**< servo algorithm, see SERVO_PI */
+    bool syntonizeOnly; /**< lock the frequency only, never steer or step the phase */
     bool noResetClock;
     bool noAdjust;
-    s16_t ap, ai;
+    s16_t ap, ai; /**< PI gains while acquiring, divisors per sync */
+    u8_t gainSteps; /**< PI gain tightening steps once calibrated, 0 keeps ap/ai fixed */
+    s32_t maxSlew; /**< once locked, slew offsets out at most this fast (ppb) instead of stepping, 0 steps */
     s16_t sDelay;
     s16_t sOffset;
+    bool holdoverAging; /**< apply the learned aging in holdover */
+    u8_t acquireSamples; /**< syncs fitted for the initial frequency, 0 disables */
+    u8_t delayWindow; /**< path delay samples to select the minimum from */
+    s32_t qPhase, qFreq; /**< Kalman process noise, ns^2/s and ppb^2/s */
+    s32_t r; /**< Kalman measurement noise (std. dev.), ns */
 } servo_t;
 
 /**
@@ -364,13 +393,333 @@ typedef struct {
  */
 
 typedef struct {
-    s32_t y_prev;
-    s32_t y_sum;
+    s64_t y_prev;
+    s64_t y_sum;
     s16_t s;
     s16_t s_prev;
     s32_t n;
 } filter_t;
 
+/**
+ * \struct MinWindow
+ * \brief Sliding minimum over the last ''window'' samples, kept as a monotonic
+ * deque of (sample number, value) so each sample costs O(1) amortized.
+ */
+
+typedef struct {
+    s32_t value[DELAY_WINDOW_MAX];
+    u32_t index[DELAY_WINDOW_MAX];
+    u8_t head;
+    u8_t count;
+    u8_t window;
+    u32_t n;
+} minWindow_t;
+
+/**
+ * \struct Acquire
+ * \brief Sync timestamp pairs collected for the initial frequency estimate
+ */
+
+typedef struct {
+    struct {
+        s64_t x; /**< local ingress time in us */
+        s64_t y; /**< ingress - origin - correction (Tms), in ns */
+    } points[ACQUIRE_MAX_SAMPLES];
+    u8_t count;
+} acquire_t;
+
+/**
+ * \struct Holdover
+ * \brief Long term frequency knowledge kept while locked and applied when
+ * the master is lost. Drift and aging carry HOLDOVER_FRAC fractional bits.
+ */
+
+typedef struct {
+    filter_t drift_filt;
+    filter_t wander_filt;
+    s64_t drift; /**< averaged observedDrift, ppb */
+    s64_t wander; /**< average deviation of observedDrift from drift, ppb */
+    s64_t aging; /**< drift change, ppb per day */
+    s64_t checkpointDrift;
+    s32_t checkpointTime; /**< local time of checkpointDrift, seconds */
+    u32_t samples;
+    bool active;
+    s32_t start; /**< local time holdover started, seconds */
+    s32_t saveTime; /**< local time drift was last saved, seconds */
+    u32_t initialError; /**< offset from master when holdover started, ns */
+} holdover_t;
+
+/**
+ * \struct TempComp
+ * \brief Temperature feed-forward: frequency against temperature learned
+ * while locked, applied on top of every frequency adjustment
+ */
+
+typedef struct {
+    filter_t temp_filt;
+    filter_t freq_filt;
+    filter_t var_filt;
+    filter_t cov_filt;
+    s64_t temp; /**< averaged temperature, m degC */
+    s64_t freq; /**< averaged frequency (observedDrift plus feed-forward), ppb */
+    s64_t var; /**< temperature variance, m degC^2 */
+    s64_t cov; /**< temperature and frequency covariance, m degC * ppb */
+    s64_t coeff; /**< learned coefficient, scaled ppb per m degC */
+    s64_t base; /**< last frequency adjustment without feed-forward, scaled ppb */
+    s64_t applied; /**< feed-forward included in the last adjustment, scaled ppb */
+    s32_t temperature; /**< last reading, m degC */
+    s32_t reference; /**< temperature of zero feed-forward, m degC */
+    u32_t samples;
+    bool reading; /**< temperature holds a reading */
+    bool valid; /**< coeff is applied */
+} tempComp_t;
+
+/**
+ * \struct Syntonize
+ * \brief Frequency lock without phase steering: the rate of the master is
+ * measured between successive Sync messages
+ */
+
+typedef struct {
+    filter_t rate_filt;
+    filter_t error_filt;
+    timeInternal_t master; /**< origin timestamp plus correction of the last Sync */
+    timeInternal_t local; /**< ingress timestamp of the last Sync */
+    s64_t rate; /**< averaged frequency correction, scaled ppb (sign of observedDrift) */
+    s64_t error; /**< average deviation of the measured rate from rate, scaled ppb */
+    u32_t samples;
+    bool valid; /**< master and local hold the last Sync */
+    bool locked;
+} syntonize_t;
+
+/**
+ * \struct Slew
+ * \brief Bounded rate catch-up of offsets too large for the servo
+ */
+
+typedef struct {
+    s64_t start; /**< offset when the catch-up started, ns */
+    s64_t remaining; /**< offset at the last Sync, ns */
+    bool active;
+    bool locked; /**< the servo has locked, the clock is not stepped any more */
+} slew_t;
+
+/**
+ * \struct Standby
+ * \brief Offset and path delay to the BMC runner-up, measured from its Syncs
+ * while locked to the parent, so a failover to it needs no relock
+ */
+
+typedef struct {
+    portIdentity_t portIdentity; /**< master tracked */
+    timeInternal_t Tms; /**< master to slave delay of its last Sync */
+    timeInternal_t offset; /**< filtered offset from it */
+    timeInternal_t delay; /**< filtered mean path delay to it (E2E) */
+    filter_t ofm_filt;
+    filter_t owd_filt;
+    minWindow_t owd_sel;
+    timeInternal_t syncIngress; /**< of a two step Sync waiting for its Follow_Up */
+    timeInternal_t correctionSync;
+    s16_t syncSequenceId;
+    bool waitingForFollowUp;
+    bool valid; /**< Tms holds its last Sync */
+    s8_t logSyncInterval;
+    u32_t lastSync; /**< sys_now() of the last offset */
+    u32_t samples; /**< offsets measured */
+    u32_t delaySamples; /**< path delays measured */
+    u32_t switches; /**< failovers without a relock */
+} standby_t;
+
+/**
+ * \struct SyncFaultProbe
+ * \brief Two step Sync of a sync-faulted master waiting for its Follow_Up
+ */
+
+typedef struct {
+    portIdentity_t portIdentity; /**< master of the Sync */
+    timeInternal_t syncIngress;
+    timeInternal_t correctionSync;
+    s16_t syncSequenceId;
+    bool waitingForFollowUp;
+} syncFaultProbe_t;
+
+/**
+ * \struct SyncReceipt
+ * \brief Sequence of the Sync messages from the parent and their counters
+ */
+
+typedef struct {
+    u16_t sequenceId; /**< of the last Sync used */
+    bool valid; /**< sequenceId holds one */
+    u32_t missing; /**< sequenceIds skipped */
+    u32_t duplicate; /**< Syncs repeating the last sequenceId */
+    u32_t outOfOrder; /**< Syncs older than the last one */
+    u32_t timeouts; /**< sync receipt timeouts */
+} syncReceipt_t;
+
+/**
+ * \struct PtpRequest
+ * \brief Settings passed from the application to the PTP thread, which
+ * owns the data sets. Accessed under SYS_ARCH_PROTECT.
+ */
+
+typedef struct {
+    u8_t pending; /**< REQUEST_* flags */
+    s32_t delayAsymmetry; /**< ns */
+    s32_t calibrationOffset; /**< true offset from master, ns */
+    u8_t servoType; /**< SERVO_* */
+    u32_t authTxKeyId; /**< key-ID to sign with */
+} ptpRequest_t;
+
+/**
+ * \struct OutlierGate
+ * \brief Recent offsets for the median/MAD outlier gate and its counters
+ */
+
+typedef struct {
+    s32_t samples[OUTLIER_WINDOW];
+    u8_t head;
+    u8_t count;
+    u8_t consecutive; /**< rejections since the last accepted offset */
+    u32_t rejected; /**< offsets rejected as outliers */
+    u32_t resets; /**< gate restarts after persistent rejections */
+} outlierGate_t;
+
+/**
+ * \struct StabilityOctave
+ * \brief Stability estimator state for tau = 2^k sync intervals. Blocks of
+ * 2^k offsets are built by pairing blocks of the octave below.
+ */
+
+typedef struct {
+    s32_t dec[2]; /**< first offset of the last two blocks, ns */
+    s32_t avg[2]; /**< average of the last two blocks, ns */
+    s32_t max, min; /**< extremes of the last block, ns */
+    s32_t pendDec, pendAvg, pendMax, pendMin; /**< first half of the next block of the octave above */
+    bool pending;
+    u8_t history; /**< blocks held in dec and avg */
+    s64_t avar; /**< mean squared second difference of dec, ns^2 */
+    s64_t tvar; /**< mean squared second difference of avg, ns^2 */
+    u32_t mtie; /**< largest peak to peak offset over a block and the next offset, ns */
+    u32_t n; /**< second differences taken */
+} stabilityOctave_t;
+
+/**
+ * \struct Stability
+ * \brief Online ADEV, TDEV and MTIE of the offset from master
+ */
+
+typedef struct {
+    stabilityOctave_t octave[STABILITY_OCTAVES];
+    s8_t logInterval; /**< sync interval (tau0) of the samples */
+    u32_t samples;
+} stability_t;
+
+/**
+ * \struct ServoPi
+ * \brief PI servo private state, ptpClock->observedDrift is the I term in ppb
+ */
+
+typedef struct {
+    s64_t integral; /**< the I term in scaled ppb */
+    s32_t lastOffset;
+    u32_t samples;
+    s64_t mean; /**< smoothed offset, ns * 2^GAIN_VAR_S */
+    s64_t var; /**< smoothed squared offset, ns^2 */
+    u32_t dwell; /**< syncs since the gains last changed */
+    u8_t step; /**< gain schedule position, 0 is ap/ai */
+    s8_t logSyncInterval; /**< sync interval the schedule was set for */
+} servoPi_t;
+
+#if LWIP_PTP_SERVO_LINREG
+
+/**
+ * \struct ServoLinreg
+ * \brief Linear regression servo private state
+ */
+
+typedef struct {
+    struct {
+        s64_t x; /**< local time of the sample in us */
+        s64_t y; /**< offset with our own corrections removed, in ns */
+    } points[LINREG_MAX_POINTS];
+    u8_t head;
+    u8_t count;
+    u8_t order; /**< selected window is 2^order samples */
+    s32_t err[LINREG_MAX_ORDER + 1]; /**< averaged prediction error per window */
+    s64_t phase; /**< phase removed by our corrections, in ppb * us */
+    s64_t lastX;
+    s64_t lastAdj; /**< scaled ppb */
+} servoLinreg_t;
+
+#endif /* LWIP_PTP_SERVO_LINREG */
+
+#if LWIP_PTP_SERVO_KALMAN
+
+/**
+ * \struct ServoKalman
+ * \brief Kalman servo private state. The state (phase, frequency) is in
+ * ns and ppb with KALMAN_FRAC fractional bits, the covariance with
+ * KALMAN_COV_FRAC fractional bits.
+ */
+
+typedef struct {
+    s64_t phase;
+    s64_t freq;
+    s64_t p00, p01, p11; /**< covariance, ns^2, ns * ppb and ppb^2 */
+    s64_t lastX; /**< local time of the last sample in us */
+    s64_t lastAdj; /**< scaled ppb */
+    u32_t samples;
+} servoKalman_t;
+
+#endif /* LWIP_PTP_SERVO_KALMAN */
+
+#if LWIP_PTP_AUTH
+
+/**
+ * \struct Sha256
+ * \brief SHA-256 running hash state
+ */
+
+typedef struct {
+    u32_t state[8];
+    u64_t length;
+    u8_t block[64];
+    u8_t blockLength;
+} sha256_t;
+
+/**
+ * \struct AuthKey
+ * \brief Security association of one key-ID (Annex P). The HMAC inner and
+ * outer hash states are computed once when the key is installed.
+ */
+
+typedef struct {
+    bool valid;
+    u32_t keyId;
+    u8_t icvLength;
+    sha256_t inner;
+    sha256_t outer;
+} authKey_t;
+
+/**
+ * \struct AuthDS
+ * \brief Authentication key table and counters
+ */
+
+typedef struct {
+    authKey_t keys[LWIP_PTP_AUTH_MAX_KEYS];
+    authKey_t *txKey; /**< key used to sign outgoing messages, NULL if none */
+    authKey_t queued[LWIP_PTP_AUTH_MAX_KEYS]; /**< keys set by the application, installed by the PTP thread. Accessed under SYS_ARCH_PROTECT. */
+
+    u32_t rxAuthenticated;
+    u32_t rxMissingTlv;
+    u32_t rxUnknownKey;
+    u32_t rxBadIcv;
+} authDS_t;
+
+#endif /* LWIP_PTP_AUTH */
+
 /**
  * \struct RunTimeOpts
  * \brief Program options set at run-time
@@ -389,6 +738,7 @@ typedef struct {
     u8_t stats;
     octet_t unicastAddress[NET_ADDRESS_LENGTH];
     timeInternal_t inboundLatency, outboundLatency;
+    timeInternal_t delayAsymmetry; /**< spec 11.6 */
     s16_t maxForeignRecords;
     u8_t delayMechanism;
     servo_t servo;
@@ -469,6 +819,8 @@ typedef struct {
     octet_t msgIbuf[PACKET_SIZE]; /** <buffer for incomming message - TO BE REMOVED AT SOME POINT */
     ssize_t msgIbufLength; /**< length of incomming message */
 
+    timeInternal_t rawOffsetFromMaster; /**< offset from master before filtering */
+
     timeInternal_t Tms; /**< Time Master -> Slave */
     timeInternal_t Tsm; /**< Time Slave -> Master */
 
@@ -496,10 +848,36 @@ typedef struct {
     bool waitingForPDelayRespFollowUp; /**< true if PDelayResp message was recieved and 2step flag is set */
 
     filter_t ofm_filt; /**< filter offset from master */
-    filter_t owd_filt; /**< filter one way delay */
-    filter_t slv_filt; /**< filter scaled log variance */
-    s16_t offsetHistory[2];
-    s32_t observedDrift;
+    outlierGate_t ofm_gate; /**< offset from master outlier rejection */
+    filter_t asymmetry_filt; /**< delay asymmetry calibration */
+    filter_t owd_filt; /**< filter one way delay (E2E) */
+    minWindow_t owd_sel; /**< one way delay packet selection (E2E) */
+    filter_t pdelay_filt; /**< filter peer delay (P2P) */
+    minWindow_t pdelay_sel; /**< peer delay packet selection (P2P) */
+    stability_t stability; /**< offset from master stability */
+    s32_t observedDrift; /**< frequency estimate of the servo */
+    s32_t lockedDrift; /**< observedDrift when the servo was last locked */
+    bool lockedDriftValid;
+    acquire_t acquire; /**< initial frequency acquisition */
+    holdover_t holdover; /**< frequency holdover without a master */
+    tempComp_t tempComp; /**< temperature feed-forward */
+    syntonize_t syntonize; /**< frequency lock of the syntonization only mode */
+    slew_t slew; /**< bounded slew catch-up */
+    standby_t standby; /**< hot standby on the BMC runner-up */
+    syncFaultProbe_t syncFaultProbe; /**< Syncs of a sync-faulted master */
+    syncReceipt_t syncReceipt; /**< Sync sequence and receipt timeout */
+    ptpRequest_t request; /**< pending requests from the application */
+
+    const struct servoOps *servoOps; /**< selected clock servo */
+    union {
+        servoPi_t pi;
+#if LWIP_PTP_SERVO_LINREG
+        servoLinreg_t linreg;
+#endif
+#if LWIP_PTP_SERVO_KALMAN
+        servoKalman_t kalman;
+#endif
+    } servoData; /**< private state of the selected clock servo */
 
     bool messageActivity;
 
@@ -511,6 +889,10 @@ typedef struct {
 
     servo_t servo;
 
+#if LWIP_PTP_AUTH
+    authDS_t auth; /**< authentication key table */
+#endif
+
     s32_t  events;
 
     u8_t  stats;
@@ -42,9 +42,17 @@
      * @brief function used to update the system time by adjusting the frequency
      * of the system clock.
      */
-    #if !defined LWIP_PTP_UPDATE_FINE || defined __DOXYGEN__
+    #if (!defined LWIP_PTP_UPDATE_FINE && !defined LWIP_PTP_UPDATE_FINE_SCALED) || defined __DOXYGEN__
         #error "No 'LWIP_PTP_UPDATE_FINE' function configured in lwipopts.h!"
-    #endif /* !defined LWIP_PTP_UPDATE_FINE || defined __DOXYGEN__ */
+    #endif /* (!defined LWIP_PTP_UPDATE_FINE && !defined LWIP_PTP_UPDATE_FINE_SCALED) || defined __DOXYGEN__ */
+
+    /**
+     * LWIP_PTP_UPDATE_FINE_SCALED
+     * @brief optional replacement of LWIP_PTP_UPDATE_FINE taking the frequency
+     * adjustment in scaled ppb (s64_t, 2^-ADJ_FREQ_SCALE ppb), see
+     * lwipPtpAddend(). Without it adjustments are rounded to whole ppb for
+     * LWIP_PTP_UPDATE_FINE and the remainder is carried to the next update.
+     */
 
     /**
      * LWIP_PTP_INIT_TIMERS
@@ -78,6 +86,106 @@
         #error "No 'LWIP_PTP_CHECK_TIMER' function configured in lwipopts.h!"
     #endif /* !defined LWIP_PTP_CHECK_TIMER || defined __DOXYGEN__ */
 
+    /**
+     * LWIP_PTP_ADJ_PHASE
+     * @brief optional function used to shift the PTP time by a signed number
+     * of nanoseconds in one atomic update (e.g. the STM32 ETH PTP time update
+     * register). When configured, the servos correct phase through it and
+     * steer the frequency with their frequency estimate only. Without it the
+     * servos correct phase by detuning the frequency.
+     */
+
+    /**
+     * LWIP_PTP_SAVE_DRIFT
+     * @brief optional function used to keep the learned oscillator frequency
+     * across reboots: LWIP_PTP_SAVE_DRIFT(s32_t drift, u32_t seconds) should
+     * write the long term averaged frequency correction (ppb) and the PTP time
+     * it was taken at to non-volatile memory. It is called at most every
+     * DRIFT_SAVE_INTERVAL seconds. Must be configured together with
+     * LWIP_PTP_RESTORE_DRIFT.
+     */
+
+    /**
+     * LWIP_PTP_RESTORE_DRIFT
+     * @brief optional function used to read back the values written by
+     * LWIP_PTP_SAVE_DRIFT: bool LWIP_PTP_RESTORE_DRIFT(s32_t *drift,
+     * u32_t *seconds) returns false if nothing was stored. The value is only
+     * used if the local clock shows it is at most DRIFT_MAX_AGE old, so the
+     * clock must keep time across resets (e.g. RTC backed).
+     */
+    /**
+     * LWIP_PTP_GET_TEMPERATURE
+     * @brief optional function used to read the oscillator temperature:
+     * bool LWIP_PTP_GET_TEMPERATURE(s32_t *temperature) fills in degrees C
+     * * 1000 and returns false if there is no reading. While locked the servo
+     * learns how the frequency follows the temperature and then corrects
+     * temperature changes as they happen. It is called every protocol
+     * iteration, so it should return a cached value.
+     */
+
+    #if defined(LWIP_PTP_SAVE_DRIFT) != defined(LWIP_PTP_RESTORE_DRIFT)
+        #error "'LWIP_PTP_SAVE_DRIFT' and 'LWIP_PTP_RESTORE_DRIFT' must be configured together in lwipopts.h!"
+    #endif /* defined(LWIP_PTP_SAVE_DRIFT) != defined(LWIP_PTP_RESTORE_DRIFT) */
+
+    /**
+     * LWIP_PTP_AUTH
+     * @brief enable the IEEE 1588-2019 Annex P AUTHENTICATION TLV. Outgoing
+     * messages carry an HMAC-SHA256 ICV and received messages are dropped
+     * before any processing unless they carry a valid ICV.
+     */
+    #if !defined LWIP_PTP_AUTH || defined __DOXYGEN__
+        #define LWIP_PTP_AUTH               0
+    #endif /* !defined LWIP_PTP_AUTH || defined __DOXYGEN__ */
+
+    /**
+     * LWIP_PTP_AUTH_MAX_KEYS
+     * @brief number of entries in the authentication key-ID table.
+     */
+    #if !defined LWIP_PTP_AUTH_MAX_KEYS || defined __DOXYGEN__
+        #define LWIP_PTP_AUTH_MAX_KEYS      4
+    #endif /* !defined LWIP_PTP_AUTH_MAX_KEYS || defined __DOXYGEN__ */
+
+    /**
+     * LWIP_PTP_SERVO
+     * @brief clock servo used by default (SERVO_PI, ...). Can be changed at
+     * run-time with lwipPtpSetServo().
+     */
+    #if !defined LWIP_PTP_SERVO || defined __DOXYGEN__
+        #define LWIP_PTP_SERVO              SERVO_PI
+    #endif /* !defined LWIP_PTP_SERVO || defined __DOXYGEN__ */
+
+    /**
+     * LWIP_PTP_SERVO_LINREG
+     * @brief build the linear regression servo (SERVO_LINREG).
+     */
+    #if !defined LWIP_PTP_SERVO_LINREG || defined __DOXYGEN__
+        #define LWIP_PTP_SERVO_LINREG       1
+    #endif /* !defined LWIP_PTP_SERVO_LINREG || defined __DOXYGEN__ */
+
+    /**
+     * LWIP_PTP_SERVO_KALMAN
+     * @brief build the Kalman filter servo (SERVO_KALMAN).
+     */
+    #if !defined LWIP_PTP_SERVO_KALMAN || defined __DOXYGEN__
+        #define LWIP_PTP_SERVO_KALMAN       1
+    #endif /* !defined LWIP_PTP_SERVO_KALMAN || defined __DOXYGEN__ */
+
+    /**
+     * LWIP_PTP_FOREIGN_MASTERS
+     * @brief number of foreign masters tracked at once. When the table is
+     * full a new master replaces the worst ranked unqualified one, else the
+     * worst ranked; the parent, the best and the runner-up are never
+     * replaced, so more masters than records only churn the worst ones. With fewer than four records a new
+     * master may find no room and is ignored until one ages out.
+     */
+    #if !defined LWIP_PTP_FOREIGN_MASTERS || defined __DOXYGEN__
+        #define LWIP_PTP_FOREIGN_MASTERS    5
+    #endif /* !defined LWIP_PTP_FOREIGN_MASTERS || defined __DOXYGEN__ */
+
+    #if LWIP_PTP_FOREIGN_MASTERS < 1 || LWIP_PTP_FOREIGN_MASTERS > 0x7FFF
+        #error "'LWIP_PTP_FOREIGN_MASTERS' must be 1..32767 in lwipopts.h!"
+    #endif /* LWIP_PTP_FOREIGN_MASTERS < 1 || LWIP_PTP_FOREIGN_MASTERS > 0x7FFF */
+
 #endif /* LWIP_PTP || defined __DOXYGEN__ */
 
 
@@ -92,32 +200,42 @@
 /* Implementation specific constants */
 #define DEFAULT_INBOUND_LATENCY         0       /* in nsec */
 #define DEFAULT_OUTBOUND_LATENCY        0       /* in nsec */
+#define DEFAULT_DELAY_ASYMMETRY         0       /* in nsec, master to slave delay minus the mean path delay */
 #define DEFAULT_NO_RESET_CLOCK          false
+#define DEFAULT_SYNTONIZE_ONLY          false /* frequency lock only, no phase steering and no delay requests */
 #define DEFAULT_DOMAIN_NUMBER           0
 #define DEFAULT_DELAY_MECHANISM         E2E
 #define DEFAULT_AP                      2
 #define DEFAULT_AI                      16
+#define DEFAULT_GAIN_STEPS              3 /* PI gain tightening steps once calibrated, 0 keeps ap/ai fixed */
+#define DEFAULT_MAX_SLEW                0 /* ppb, once locked slew large offsets out instead of stepping, 0 steps */
 #define DEFAULT_DELAY_S                 6 /* exponencial smoothing - 2^s */
 #define DEFAULT_OFFSET_S                1 /* exponencial smoothing - 2^s */
+#define DEFAULT_ACQUIRE_SAMPLES         4 /* syncs used to estimate the initial frequency, 0 disables */
+#define DEFAULT_HOLDOVER_AGING          false /* extrapolate the drift trend in holdover */
+#define DEFAULT_DELAY_WINDOW            8 /* path delay packet selection, 1 disables */
+#define DEFAULT_KALMAN_Q_PHASE          100 /* phase process noise, ns^2/s */
+#define DEFAULT_KALMAN_Q_FREQ           1 /* frequency process noise, ppb^2/s */
+#define DEFAULT_KALMAN_R                1000 /* measurement noise (std. dev.), ns */
 #define DEFAULT_ANNOUNCE_INTERVAL       1 /* 0 in 802.1AS */
 #define DEFAULT_UTC_OFFSET              34
 #define DEFAULT_UTC_VALID               false
 #define DEFAULT_PDELAYREQ_INTERVAL      1 /* -4 in 802.1AS */
 #define DEFAULT_DELAYREQ_INTERVAL       3 /* from DEFAULT_SYNC_INTERVAL to DEFAULT_SYNC_INTERVAL + 5 */
 #define DEFAULT_SYNC_INTERVAL           0 /* -7 in 802.1AS */
-#define DEFAULT_SYNC_RECEIPT_TIMEOUT    3
+#define DEFAULT_SYNC_RECEIPT_TIMEOUT    3 /* sync intervals without a Sync from the parent */
 #define DEFAULT_ANNOUNCE_RECEIPT_TIMEOUT 6 /* 3 by default */
 #define DEFAULT_QUALIFICATION_TIMEOUT   -9 /* DEFAULT_ANNOUNCE_INTERVAL + N */
-#define DEFAULT_FOREIGN_MASTER_TIME_WINDOW 4
-#define DEFAULT_FOREIGN_MASTER_THRESHOLD 2
+#define DEFAULT_FOREIGN_MASTER_TIME_WINDOW 4 /* announce intervals, spec 9.3.2.4.4 */
+#define DEFAULT_FOREIGN_MASTER_THRESHOLD 2 /* Announce messages in the window to qualify, spec 9.3.2.4.5 */
 #define DEFAULT_CLOCK_CLASS             248
 #define DEFAULT_CLOCK_CLASS_SLAVE_ONLY  255
 #define DEFAULT_CLOCK_ACCURACY          0xFE
 #define DEFAULT_PRIORITY1               248
 #define DEFAULT_PRIORITY2               248
 #define DEFAULT_CLOCK_VARIANCE          5000 /* To be determined in 802.1AS */
-#define DEFAULT_MAX_FOREIGN_RECORDS     5
-#define DEFAULT_PARENTS_STATS           false
+#define DEFAULT_MAX_FOREIGN_RECORDS     LWIP_PTP_FOREIGN_MASTERS
+#define DEFAULT_PARENTS_STATS           true
 #define DEFAULT_TWO_STEP_FLAG           true /* Transmitting only SYNC message or SYNC and FOLLOW UP */
 #define DEFAULT_TIME_SOURCE             INTERNAL_OSCILLATOR
 #define DEFAULT_TIME_TRACEABLE          false /* time derived from atomic clock? */
@@ -129,6 +247,77 @@
 #define MAX_ADJ_OFFSET_NS       1000000000 /* max offset to try to adjust it < 100ms */
 /// @todo remove modded NS offset max.
 
+/* Linear regression servo: window of 2^LINREG_MIN_ORDER to 2^LINREG_MAX_ORDER samples */
+#define LINREG_MIN_ORDER        2
+#define LINREG_MAX_ORDER        6
+#define LINREG_MAX_POINTS       (1 << LINREG_MAX_ORDER)
+#define LINREG_ERR_S            2 /* prediction error smoothing - 2^s */
+
+/* PI gain schedule: each step halves the loop bandwidth (ap * 2, ai * 4) */
+#define GAIN_STEPS_MAX          6
+#define GAIN_VAR_S              4 /* offset mean and variance smoothing, dwell per step - 2^s syncs */
+#define GAIN_TIGHTEN            16 /* tighten while mean^2 is below 1/16 of the mean square offset */
+#define GAIN_LOOSEN             4 /* loosen when mean^2 is above 1/4 of it */
+
+/* Clock stability (ADEV, TDEV, MTIE) over tau = 2^0 .. 2^(STABILITY_OCTAVES - 1) sync intervals */
+#define STABILITY_OCTAVES       8
+#define STABILITY_AVG_S         6 /* running mean of the first 2^s estimates, then exponencial smoothing */
+#define STABILITY_MIN_SAMPLES   16 /* offsets needed before the clock quality is updated */
+
+/* Range of message intervals adopted from the master, log2 seconds */
+#define LOG_INTERVAL_MIN        -7
+#define LOG_INTERVAL_MAX        7
+
+/* Syntonization only: rate measured between successive Syncs, averaged over 2^SYNTONIZE_S */
+#define SYNTONIZE_S             6 /* exponencial smoothing - 2^s */
+#define SYNTONIZE_ERROR_S       4 /* rate deviation smoothing - 2^s */
+#define SYNTONIZE_MIN_SAMPLES   8 /* rates measured before the port may be calibrated */
+#define SYNTONIZE_CALIBRATED_PPB 100 /* uncertainty of the averaged rate < 0.1ppm -> calibrated */
+#define SYNTONIZE_UNCALIBRATED_PPB 1000 /* uncertainty of the averaged rate > 1ppm -> uncalibrated */
+
+/* Delay asymmetry calibration: reference offsets averaged over 2^s */
+#define ASYMMETRY_CAL_S         4 /* exponencial smoothing - 2^s */
+
+/* Hot standby: offset and path delay to the BMC runner-up for a hitless failover */
+#define STANDBY_MIN_SAMPLES     8 /* offsets measured before the standby may take over */
+#define STANDBY_TIMEOUT         4 /* sync intervals without an offset before the standby is cold */
+
+/* Initial frequency acquisition: most Sync samples fitted */
+#define ACQUIRE_MAX_SAMPLES     16
+
+/* Holdover: long term drift average, valid after HOLDOVER_MIN_SAMPLES locked syncs */
+#define HOLDOVER_FRAC           8 /* fractional bits of drift and aging */
+#define HOLDOVER_DRIFT_S        8 /* exponencial smoothing - 2^s */
+#define HOLDOVER_MIN_SAMPLES    (1 << HOLDOVER_DRIFT_S)
+#define HOLDOVER_AGING_PERIOD   3600 /* seconds between aging estimates */
+#define HOLDOVER_SPEC_NS        DEFAULT_CALIBRATED_OFFSET_NS /* estimated error still within holdover specification */
+
+/* Temperature feed-forward, learned over 2^TEMP_COMP_S locked syncs */
+#define TEMP_COMP_S             8 /* exponencial smoothing - 2^s */
+#define TEMP_COMP_MIN_DEV       250 /* temperature deviation (m degC) needed to use the coefficient */
+#define TEMP_COMP_COEFF_MAX     10000 /* ppb per degC */
+#define TEMP_COMP_UPDATE        ((s64_t)1 << ADJ_FREQ_SCALE) /* feed-forward change (scaled ppb) applied between syncs */
+
+/* Stored frequency: save period, oldest and largest value restored */
+#define DRIFT_SAVE_INTERVAL     3600 /* seconds */
+#define DRIFT_MAX_AGE           (30 * 86400) /* seconds */
+#define DRIFT_RESTORE_MAX       500000 /* ppb */
+
+/* Path delay packet selection: longest min-of-window supported */
+#define DELAY_WINDOW_MAX        32
+
+/* Offset outlier gate: running median and MAD over the last OUTLIER_WINDOW offsets */
+#define OUTLIER_WINDOW          15
+#define OUTLIER_MIN_SAMPLES     5 /* samples needed before the gate closes */
+#define OUTLIER_MAD_K           6 /* reject beyond k * MAD from the median */
+#define OUTLIER_MIN_NS          1000 /* never reject closer than this to the median */
+#define OUTLIER_MAX_REJECT      4 /* consecutive rejections are taken as a real step */
+
+/* Kalman servo: fractional bits of the state (at most ADJ_FREQ_SCALE) and covariance */
+#define KALMAN_FRAC             8
+#define KALMAN_COV_FRAC         16
+#define KALMAN_FREQ_VAR_INIT    ((s64_t)100000 * 100000) /* 100ppm initial uncertainty, ppb^2 */
+
 /* features, only change to refelect changes in implementation */
 #define NUMBER_PORTS      1
 #define VERSION_PTP       2
@@ -152,6 +341,20 @@
 #define PDELAY_RESP_LENGTH            54
 #define PDELAY_RESP_FOLLOW_UP_LENGTH  54
 #define MANAGEMENT_LENGTH             48
+#define SIGNALING_LENGTH              44
+/** \}*/
+
+/** \name Authentication TLV (IEEE 1588-2019 Annex P)
+ AUTHENTICATION TLV without the optional fields: tlvType, lengthField,
+ SPP, secParamIndicator and keyID followed by the ICV.*/
+/**\{*/
+#define TLV_AUTHENTICATION            0x8009
+#define TLV_HEADER_LENGTH             4
+#define AUTH_TLV_LENGTH               10 /* up to the start of the ICV */
+#define AUTH_SPP                      0
+#define AUTH_HMAC_LENGTH              32 /* HMAC-SHA256 */
+#define AUTH_ICV_LENGTH_MIN           10
+#define DEFAULT_AUTH_ICV_LENGTH       16 /* truncated HMAC-SHA256-128 */
 /** \}*/
 
 /* lwIP constants */
@@ -177,6 +380,11 @@
 
 #define ADJ_FREQ_MAX  32768000   /* Value is from ntp_adjtime in Linux kernel */
 
+/* Frequency adjustments between servo and driver carry ADJ_FREQ_SCALE
+ * fractional bits (scaled ppb, 2^-16 ppb) */
+#define ADJ_FREQ_SCALE          16
+#define ADJ_FREQ_MAX_SCALED     ((s64_t)ADJ_FREQ_MAX << ADJ_FREQ_SCALE)
+
 /* UDP/IPv4 dependent */
 
 #define SUBDOMAIN_ADDRESS_LENGTH  4
@@ -282,7 +490,8 @@ enum
     SYNC_INTERVAL_TIMER,/**<\brief Timer handling Interval between master sends two Syncs messages */
     ANNOUNCE_RECEIPT_TIMER,/**<\brief Timer handling announce receipt timeout */
     ANNOUNCE_INTERVAL_TIMER, /**<\brief Timer handling interval before master sends two announce messages */
-    QUALIFICATION_TIMEOUT
+    QUALIFICATION_TIMEOUT,
+    SYNC_RECEIPT_TIMER /**<\brief Timer handling sync receipt timeout */
 };
 
 /**
@@ -371,6 +580,37 @@ enum
     MASTER_CLOCK_CHANGED = 0x0800,
 };
 
+/**
+ * \brief requests from the application, applied by the PTP thread
+ */
+enum
+{
+    REQUEST_DELAY_ASYMMETRY = 0x01,
+    REQUEST_CALIBRATE_ASYMMETRY = 0x02,
+    REQUEST_SERVO = 0x04,
+    REQUEST_AUTH_KEY = 0x08,
+    REQUEST_AUTH_TX_KEY = 0x10,
+};
+
+/**
+ * \brief clock servo algorithms
+ */
+enum
+{
+    SERVO_PI = 0,
+    SERVO_LINREG,
+    SERVO_KALMAN,
+};
+
+/**
+ * \brief clock servo lock state
+ */
+enum
+{
+    SERVO_UNLOCKED = 0,
+    SERVO_LOCKED
+};
+
 /**
  * \brief ptp time scale
  */
@@ -12,21 +12,37 @@
 
 #if LWIP_PTP || defined __DOXYGEN__
 
+#include <stdlib.h>
+#include <string.h>
+
 #include <lwip/sys.h>
 #include <lwip/api.h>
 #include <lwip/netbuf.h>
 
+#include "arith.h"
+#include "auth.h"
 #include "protocol.h"
+#include "servo.h"
+#include "stability.h"
 #include "sys_time.h"
 
 ptpClock_t ptpClock;
 runTimeOpts_t rtOpts;
 foreignMasterRecord_t ptpForeignRecords[DEFAULT_MAX_FOREIGN_RECORDS];
+s16_t ptpForeignBuckets[DEFAULT_MAX_FOREIGN_RECORDS];
 
 sys_mbox_t ptpAlert;
 
 /*---------------------------- Private Functions -----------------------------*/
 
+/* Wake the PTP thread up to run doState() */
+static void ptpWake(void)
+{
+    if(sys_mbox_trypost(&ptpAlert, NULL) != ERR_OK) {
+        DBGVV("Mailbox Full!\n");
+    }
+}
+
 
 
 
@@ -44,27 +60,52 @@ static void ptpd_thread(void *args __attribute((unused)))
     rtOpts.domainNumber = DEFAULT_DOMAIN_NUMBER;
     rtOpts.slaveOnly = SLAVE_ONLY;
     rtOpts.currentUtcOffset = DEFAULT_UTC_OFFSET;
+    rtOpts.servo.type = LWIP_PTP_SERVO;
+    rtOpts.servo.syntonizeOnly = DEFAULT_SYNTONIZE_ONLY;
     rtOpts.servo.noResetClock = DEFAULT_NO_RESET_CLOCK;
     rtOpts.servo.noAdjust = NO_ADJUST;
     rtOpts.inboundLatency.nanoseconds = DEFAULT_INBOUND_LATENCY;
     rtOpts.outboundLatency.nanoseconds = DEFAULT_OUTBOUND_LATENCY;
+    rtOpts.delayAsymmetry.nanoseconds = DEFAULT_DELAY_ASYMMETRY;
     rtOpts.servo.sDelay = DEFAULT_DELAY_S;
     rtOpts.servo.sOffset = DEFAULT_OFFSET_S;
     rtOpts.servo.ap = DEFAULT_AP;
     rtOpts.servo.ai = DEFAULT_AI;
+    rtOpts.servo.gainSteps = DEFAULT_GAIN_STEPS;
+    rtOpts.servo.maxSlew = DEFAULT_MAX_SLEW;
+    rtOpts.servo.holdoverAging = DEFAULT_HOLDOVER_AGING;
+    rtOpts.servo.acquireSamples = DEFAULT_ACQUIRE_SAMPLES;
+    rtOpts.servo.delayWindow = DEFAULT_DELAY_WINDOW;
+    rtOpts.servo.qPhase = DEFAULT_KALMAN_Q_PHASE;
+    rtOpts.servo.qFreq = DEFAULT_KALMAN_Q_FREQ;
+    rtOpts.servo.r = DEFAULT_KALMAN_R;
     rtOpts.maxForeignRecords = sizeof(ptpForeignRecords) / sizeof(ptpForeignRecords[0]);
     rtOpts.stats = PTP_TEXT_STATS;
     rtOpts.delayMechanism = DEFAULT_DELAY_MECHANISM;
 
     ptpClock.rtOpts = &rtOpts;
     ptpClock.foreignMasterDS.records = ptpForeignRecords;
+    ptpClock.foreignMasterDS.buckets = ptpForeignBuckets;
 
     /* 9.2.2 */
     if (rtOpts.slaveOnly) rtOpts.clockQuality.clockClass = DEFAULT_CLOCK_CLASS_SLAVE_ONLY;
 
+    /* The path delay only matters to the phase, skip Delay_Req */
+    if (rtOpts.servo.syntonizeOnly) rtOpts.delayMechanism = DELAY_DISABLED;
+
     /* No negative or zero attenuation */
     if (rtOpts.servo.ap < 1) rtOpts.servo.ap = 1;
     if (rtOpts.servo.ai < 1) rtOpts.servo.ai = 1;
+    if (rtOpts.servo.gainSteps > GAIN_STEPS_MAX) rtOpts.servo.gainSteps = GAIN_STEPS_MAX;
+    if (rtOpts.servo.maxSlew < 0) rtOpts.servo.maxSlew = 0;
+    if (rtOpts.servo.maxSlew > ADJ_FREQ_MAX) rtOpts.servo.maxSlew = ADJ_FREQ_MAX;
+    if (rtOpts.servo.acquireSamples > ACQUIRE_MAX_SAMPLES) rtOpts.servo.acquireSamples = ACQUIRE_MAX_SAMPLES;
+    if (rtOpts.servo.acquireSamples == 1) rtOpts.servo.acquireSamples = 2;
+    if (rtOpts.servo.delayWindow < 1) rtOpts.servo.delayWindow = 1;
+    if (rtOpts.servo.delayWindow > DELAY_WINDOW_MAX) rtOpts.servo.delayWindow = DELAY_WINDOW_MAX;
+    if (rtOpts.servo.qPhase < 0) rtOpts.servo.qPhase = 0;
+    if (rtOpts.servo.qFreq < 0) rtOpts.servo.qFreq = 0;
+    if (rtOpts.servo.r < 1) rtOpts.servo.r = 1;
 
     toState(&ptpClock, PTP_INITIALIZING);
 
@@ -96,9 +137,7 @@ static void ptpd_thread(void *args __attribute((unused)))
 void lwipPtpTimerExpired(u32_t idx)
 {
     UNUSED(idx);
-    if(sys_mbox_trypost(&ptpAlert, NULL) != ERR_OK) {
-        DBGVV("Mailbox Full!\n");
-    }
+    ptpWake();
 }
 
 /**
@@ -140,6 +179,333 @@ void lwipPtpTxNotify(void)
     sys_sem_signal(&ptpClock.netPath.ptpTxNotify);
 }
 
+/**
+ * @brief Install an authentication key (IEEE 1588-2019 Annex P). Installed
+ * by the PTP thread.
+ * @param keyId key identifier carried in the TLV.
+ * @param key secret key octets.
+ * @param keyLength length of the key in octets.
+ * @param icvLength length of the truncated HMAC-SHA256 ICV (10 to 32 octets).
+ * @retval ERR_OK if the key was queued, or lwIP-style error code otherwise.
+ */
+err_t lwipPtpAuthSetKey(u32_t keyId, const u8_t *key, u16_t keyLength,
+                                                            u8_t icvLength)
+{
+#if LWIP_PTP_AUTH
+    SYS_ARCH_DECL_PROTECT(lev);
+    authKey_t entry;
+    err_t err;
+
+    /* The HMAC states are computed here, the PTP thread only copies them */
+    err = authMakeKey(&entry, keyId, key, keyLength, icvLength);
+    if (err != ERR_OK)
+        return err;
+
+    SYS_ARCH_PROTECT(lev);
+    err = authQueueKey(&ptpClock.auth, &entry);
+    if (err == ERR_OK)
+        setFlag(ptpClock.request.pending, REQUEST_AUTH_KEY);
+    SYS_ARCH_UNPROTECT(lev);
+
+    memset(&entry, 0, sizeof(entry));
+    if (err == ERR_OK)
+        ptpWake();
+    return err;
+#else
+    UNUSED(keyId); UNUSED(key); UNUSED(keyLength); UNUSED(icvLength);
+    return ERR_VAL;
+#endif
+}
+
+/**
+ * @brief Select the key used to sign outgoing messages. Applied by the PTP
+ * thread, after the keys queued before it.
+ * @param keyId key identifier of an installed or queued key.
+ * @retval ERR_OK if the request was queued.
+ */
+err_t lwipPtpAuthSetTxKey(u32_t keyId)
+{
+#if LWIP_PTP_AUTH
+    SYS_ARCH_DECL_PROTECT(lev);
+
+    SYS_ARCH_PROTECT(lev);
+    ptpClock.request.authTxKeyId = keyId;
+    setFlag(ptpClock.request.pending, REQUEST_AUTH_TX_KEY);
+    SYS_ARCH_UNPROTECT(lev);
+
+    ptpWake();
+    return ERR_OK;
+#else
+    UNUSED(keyId);
+    return ERR_VAL;
+#endif
+}
+
+/**
+ * @brief Get the counters of the offset outlier gate.
+ * @param rejected filled with the number of offsets rejected as outliers.
+ * @param resets filled with the number of restarts after persistent rejections.
+ */
+void lwipPtpGetOutlierStats(u32_t *rejected, u32_t *resets)
+{
+    if (rejected)
+        *rejected = ptpClock.ofm_gate.rejected;
+    if (resets)
+        *resets = ptpClock.ofm_gate.resets;
+}
+
+/**
+ * @brief Get the counters of the best master clock algorithm.
+ * @param events filled with the number of state decision events.
+ * @param decisions filled with the number of state decisions run.
+ * @param rescans filled with the number of full rescans of the foreign masters.
+ */
+void lwipPtpGetBmcStats(u32_t *events, u32_t *decisions, u32_t *rescans)
+{
+    if (events)
+        *events = ptpClock.foreignMasterDS.events;
+    if (decisions)
+        *decisions = ptpClock.foreignMasterDS.decisions;
+    if (rescans)
+        *rescans = ptpClock.foreignMasterDS.rescans;
+}
+
+/**
+ * @brief Get the Sync receipt counters of the slave.
+ * @param missing filled with the number of Sync sequenceIds skipped.
+ * @param duplicate filled with the number of repeated Sync messages.
+ * @param outOfOrder filled with the number of Sync messages older than the last one.
+ * @param timeouts filled with the number of Sync receipt timeouts.
+ */
+void lwipPtpGetSyncStats(u32_t *missing, u32_t *duplicate, u32_t *outOfOrder, u32_t *timeouts)
+{
+    if (missing)
+        *missing = ptpClock.syncReceipt.missing;
+    if (duplicate)
+        *duplicate = ptpClock.syncReceipt.duplicate;
+    if (outOfOrder)
+        *outOfOrder = ptpClock.syncReceipt.outOfOrder;
+    if (timeouts)
+        *timeouts = ptpClock.syncReceipt.timeouts;
+}
+
+/**
+ * @brief Get the holdover status.
+ * @param duration filled with the seconds spent in holdover.
+ * @param error filled with the estimated time error in nanoseconds.
+ * @retval true if the clock is in holdover.
+ */
+bool lwipPtpGetHoldover(u32_t *duration, u32_t *error)
+{
+    if (duration)
+        *duration = holdoverDuration(&ptpClock);
+    if (error)
+        *error = holdoverError(&ptpClock);
+
+    return ptpClock.holdover.active;
+}
+
+/**
+ * @brief Get the learned temperature coefficient.
+ * @param coeff filled with the coefficient in 10^-12 per degree C.
+ * @retval true if the coefficient is in use as temperature feed-forward.
+ */
+bool lwipPtpGetTempCoeff(s32_t *coeff)
+{
+    /* scaled ppb per m degC to 10^-12 per degC */
+    if (coeff)
+        *coeff = (s32_t)((ptpClock.tempComp.coeff * 1000000) >> ADJ_FREQ_SCALE);
+
+    return ptpClock.tempComp.valid;
+}
+
+/**
+ * @brief Select the clock servo at run-time. Applied by the PTP thread.
+ * @param type SERVO_PI, SERVO_LINREG or SERVO_KALMAN.
+ * @retval ERR_OK if the servo is built in, ERR_VAL otherwise.
+ */
+err_t lwipPtpSetServo(u8_t type)
+{
+    SYS_ARCH_DECL_PROTECT(lev);
+
+    if (!servoAvailable(type))
+        return ERR_VAL;
+
+    SYS_ARCH_PROTECT(lev);
+    ptpClock.request.servoType = type;
+    setFlag(ptpClock.request.pending, REQUEST_SERVO);
+    SYS_ARCH_UNPROTECT(lev);
+
+    ptpWake();
+    return ERR_OK;
+}
+
+/**
+ * @brief Set the path delay asymmetry and restart its calibration. Applied
+ * by the PTP thread.
+ * @param asymmetry master to slave delay minus the mean path delay in nanoseconds.
+ */
+void lwipPtpSetDelayAsymmetry(s32_t asymmetry)
+{
+    SYS_ARCH_DECL_PROTECT(lev);
+
+    SYS_ARCH_PROTECT(lev);
+    ptpClock.request.delayAsymmetry = asymmetry;
+    setFlag(ptpClock.request.pending, REQUEST_DELAY_ASYMMETRY);
+    SYS_ARCH_UNPROTECT(lev);
+
+    ptpWake();
+}
+
+/**
+ * @brief Get the path delay asymmetry in use.
+ * @retval master to slave delay minus the mean path delay in nanoseconds.
+ */
+s32_t lwipPtpGetDelayAsymmetry(void)
+{
+    return (s32_t)internalTimeToNanoseconds(&ptpClock.portDS.delayAsymmetry);
+}
+
+/**
+ * @brief Calibrate the path delay asymmetry against a reference. The
+ * measurement is applied by the PTP thread.
+ * @param offset true offset of the local clock from the master in nanoseconds.
+ * @retval ERR_OK if the measurement was queued, ERR_INPROGRESS if the last
+ * one has not been applied yet, ERR_VAL if the port is not a slave.
+ */
+err_t lwipPtpCalibrateDelayAsymmetry(s32_t offset)
+{
+    SYS_ARCH_DECL_PROTECT(lev);
+    err_t err = ERR_OK;
+
+    if (ptpClock.portDS.portState != PTP_SLAVE)
+        return ERR_VAL;
+
+    SYS_ARCH_PROTECT(lev);
+    if (getFlag(ptpClock.request.pending, REQUEST_CALIBRATE_ASYMMETRY)) {
+        err = ERR_INPROGRESS;
+    }
+    else {
+        ptpClock.request.calibrationOffset = offset;
+        setFlag(ptpClock.request.pending, REQUEST_CALIBRATE_ASYMMETRY);
+    }
+    SYS_ARCH_UNPROTECT(lev);
+
+    if (err == ERR_OK)
+        ptpWake();
+
+    return err;
+}
+
+/**
+ * @brief Get the progress of a bounded slew catch-up.
+ * @param remaining filled with the offset still to slew out in nanoseconds.
+ * @param seconds filled with the estimated time to completion.
+ * @param progress filled with the part of the offset slewed out, in percent.
+ * @retval true while catching up.
+ */
+bool lwipPtpGetCatchUp(s64_t *remaining, u32_t *seconds, u8_t *progress)
+{
+    const slew_t *slew = &ptpClock.slew;
+    u64_t left, eta;
+
+    left = slew->active ? llabs(slew->remaining) : 0;
+
+    if (remaining)
+        *remaining = slew->active ? slew->remaining : 0;
+
+    /* 1 ppb slews 1 ns per second */
+    if (seconds) {
+        eta = ptpClock.servo.maxSlew ? left / ptpClock.servo.maxSlew : 0;
+        *seconds = eta > UINT32_MAX ? UINT32_MAX : (u32_t)eta;
+    }
+
+    if (progress)
+        *progress = slew->active && slew->start ? (u8_t)(100 - mulDiv64(left, 100, llabs(slew->start))) : 100;
+
+    return slew->active;
+}
+
+/**
+ * @brief Get the hot standby status.
+ * @param offset filled with the offset from the standby master in nanoseconds.
+ * @param delay filled with the mean path delay to it in nanoseconds.
+ * @param switches filled with the number of failovers to a standby.
+ * @retval true if the standby is ready to take over.
+ */
+bool lwipPtpGetStandby(s32_t *offset, s32_t *delay, u32_t *switches)
+{
+    const standby_t *sb = &ptpClock.standby;
+
+    if (offset)
+        *offset = sb->samples ? (s32_t)internalTimeToNanoseconds(&sb->offset) : 0;
+    if (delay)
+        *delay = sb->delaySamples ? (s32_t)internalTimeToNanoseconds(&sb->delay) : 0;
+    if (switches)
+        *switches = sb->switches;
+
+    return standbyReady(&ptpClock);
+}
+
+/**
+ * @brief Get the rate of the master relative to the local oscillator.
+ * @param ratio filled with (rateRatio - 1) * 2^41.
+ * @retval true if the port is calibrated to its master.
+ */
+bool lwipPtpGetRateRatio(s32_t *ratio)
+{
+    s64_t drift, offset;
+
+    /* how much faster than the master the oscillator runs, scaled ppb */
+    if (ptpClock.servo.syntonizeOnly)
+        drift = ptpClock.syntonize.rate;
+    else
+        drift = (s64_t)ptpClock.observedDrift << ADJ_FREQ_SCALE;
+    drift += ptpClock.tempComp.applied;
+
+    /* rateRatio - 1 = -drift / (1 + drift) */
+    if (ratio) {
+        offset = mulDiv64(-drift, (s64_t)1 << 41, ((s64_t)1000000000 << ADJ_FREQ_SCALE) + drift);
+        if (offset > INT32_MAX)
+            offset = INT32_MAX;
+        else if (offset < -INT32_MAX)
+            offset = -INT32_MAX;
+        *ratio = (s32_t)offset;
+    }
+
+    return ptpClock.portDS.portState == PTP_SLAVE;
+}
+
+/**
+ * @brief Get the stability of the offset from master.
+ * @param octave tau = 2^(octave + logSyncInterval) seconds.
+ * @param adev filled with the Allan deviation in units of 10^-12.
+ * @param tdev filled with the time deviation in nanoseconds.
+ * @param mtie filled with the maximum time interval error in nanoseconds.
+ * @retval true if there is an estimate for this tau.
+ */
+bool lwipPtpGetStability(u8_t octave, u32_t *adev, u32_t *tdev, u32_t *mtie)
+{
+    return stabilityGet(&ptpClock.stability, octave, adev, tdev, mtie);
+}
+
+/**
+ * @brief Addend register value running the clock 'adj' faster than 'base'.
+ * @param base addend giving the nominal clock rate.
+ * @param adj frequency adjustment in ppb with 16 fractional bits.
+ * @retval addend register value.
+ */
+u32_t lwipPtpAddend(u32_t base, s64_t adj)
+{
+    s64_t addend = base + mulDiv64(adj, base, (s64_t)1000000000 << ADJ_FREQ_SCALE);
+
+    if (addend < 0)
+        return 0;
+    if (addend > UINT32_MAX)
+        return UINT32_MAX;
+    return (u32_t)addend;
+}
+
 /*----------------------------------------------------------------------------*/
 
 #else
@@ -152,4 +518,101 @@ void lwipPtpInit(u8_t priority) { UNUSED(priority); }
 /* If LWIP_PTP is not defined map the notify function to an empty function */
 void lwipPtpTxNotify(void) {}
 
+/* If LWIP_PTP is not defined authentication is not available */
+err_t lwipPtpAuthSetKey(u32_t keyId, const u8_t *key, u16_t keyLength,
+                        u8_t icvLength)
+{
+    UNUSED(keyId); UNUSED(key); UNUSED(keyLength); UNUSED(icvLength);
+    return ERR_VAL;
+}
+
+err_t lwipPtpAuthSetTxKey(u32_t keyId) { UNUSED(keyId); return ERR_VAL; }
+
+/* If LWIP_PTP is not defined there are no outlier statistics */
+void lwipPtpGetOutlierStats(u32_t *rejected, u32_t *resets)
+{
+    if (rejected) *rejected = 0;
+    if (resets) *resets = 0;
+}
+
+/* If LWIP_PTP is not defined the best master clock algorithm never runs */
+void lwipPtpGetBmcStats(u32_t *events, u32_t *decisions, u32_t *rescans)
+{
+    if (events) *events = 0;
+    if (decisions) *decisions = 0;
+    if (rescans) *rescans = 0;
+}
+
+/* If LWIP_PTP is not defined no Sync is ever received */
+void lwipPtpGetSyncStats(u32_t *missing, u32_t *duplicate, u32_t *outOfOrder, u32_t *timeouts)
+{
+    if (missing) *missing = 0;
+    if (duplicate) *duplicate = 0;
+    if (outOfOrder) *outOfOrder = 0;
+    if (timeouts) *timeouts = 0;
+}
+
+/* If LWIP_PTP is not defined there is no temperature feed-forward */
+bool lwipPtpGetTempCoeff(s32_t *coeff)
+{
+    if (coeff) *coeff = 0;
+    return false;
+}
+
+/* If LWIP_PTP is not defined there is no servo to select */
+err_t lwipPtpSetServo(u8_t type) { UNUSED(type); return ERR_VAL; }
+
+/* If LWIP_PTP is not defined there is no path to correct */
+void lwipPtpSetDelayAsymmetry(s32_t asymmetry) { UNUSED(asymmetry); }
+
+s32_t lwipPtpGetDelayAsymmetry(void) { return 0; }
+
+err_t lwipPtpCalibrateDelayAsymmetry(s32_t offset) { UNUSED(offset); return ERR_VAL; }
+
+/* If LWIP_PTP is not defined there is nothing to catch up with */
+bool lwipPtpGetCatchUp(s64_t *remaining, u32_t *seconds, u8_t *progress)
+{
+    if (remaining) *remaining = 0;
+    if (seconds) *seconds = 0;
+    if (progress) *progress = 100;
+    return false;
+}
+
+/* If LWIP_PTP is not defined there is no standby master */
+bool lwipPtpGetStandby(s32_t *offset, s32_t *delay, u32_t *switches)
+{
+    if (offset) *offset = 0;
+    if (delay) *delay = 0;
+    if (switches) *switches = 0;
+    return false;
+}
+
+/* If LWIP_PTP is not defined there is no master to compare with */
+bool lwipPtpGetRateRatio(s32_t *ratio)
+{
+    if (ratio) *ratio = 0;
+    return false;
+}
+
+/* If LWIP_PTP is not defined there are no statistics */
+bool lwipPtpGetStability(u8_t octave, u32_t *adev, u32_t *tdev, u32_t *mtie)
+{
+    UNUSED(octave);
+    UNUSED(adev);
+    UNUSED(tdev);
+    UNUSED(mtie);
+    return false;
+}
+
+/* If LWIP_PTP is not defined the addend is not adjusted */
+u32_t lwipPtpAddend(u32_t base, s64_t adj) { UNUSED(adj); return base; }
+
+/* If LWIP_PTP is not defined there is no holdover */
+bool lwipPtpGetHoldover(u32_t *duration, u32_t *error)
+{
+    if (duration) *duration = 0;
+    if (error) *error = 0;
+    return false;
+}
+
 #endif /* LWIP_PTP || defined __DOXYGEN__ */
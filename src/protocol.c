@@ -5,6 +5,7 @@
 #if LWIP_PTP || defined __DOXYGEN__
 
 #include "arith.h"
+#include "auth.h"
 #include "bmc.h"
 #include "msg.h"
 #include "net.h"
@@ -17,6 +18,28 @@
 /* Check and handle received messages */
 static void handle(ptpClock_t *ptpClock);
 
+/* Apply the settings requested through the API */
+static void handleRequests(ptpClock_t *ptpClock);
+
+/* Adopt a message interval advertised by the master */
+static bool adoptInterval(s8_t *interval, s8_t advertised);
+
+/* Check if the message comes from the BMC runner-up */
+static bool isFromStandby(const ptpClock_t *ptpClock);
+
+/* Check the sequenceId of a Sync from the parent */
+static bool syncSequence(ptpClock_t *ptpClock);
+
+/* Restart the sync receipt timeout after a Sync from the parent */
+static void syncReceived(ptpClock_t *ptpClock);
+
+/* Handle the parent's Syncs stopping - sync receipt timeout */
+static void syncReceiptTimeout(ptpClock_t *ptpClock);
+
+/* Check the Syncs of a sync-faulted master */
+static void faultedSync(ptpClock_t *ptpClock, const timeInternal_t *time);
+static void faultedFollowUp(ptpClock_t *ptpClock);
+
 /* Handle the announce message - spec 9.5.3 */
 static void handleAnnounce(ptpClock_t *ptpClock, bool isFromSelf);
 
@@ -50,6 +73,9 @@ static void handleSignaling(ptpClock_t *ptpClock, bool isFromSelf);
 /* Issue delay requests when the timers have expired */
 static void issueDelayReqTimerExpired(ptpClock_t *ptpClock);
 
+/* Append the trailing TLVs to a packed outgoing message */
+static s16_t appendTlvs(ptpClock_t *ptpClock, s16_t length);
+
 /* Pack and send on general multicast ip adress an Announce message */
 static void issueAnnounce(ptpClock_t *ptpClock);
 
@@ -119,7 +145,7 @@ void toState(ptpClock_t *ptpClock, u8_t state)
     switch (ptpClock->portDS.portState) {
         case PTP_MASTER:
 
-            initClock(ptpClock);
+            resetClock(ptpClock);
             LWIP_PTP_STOP_TIMER(SYNC_INTERVAL_TIMER);
             LWIP_PTP_STOP_TIMER(ANNOUNCE_INTERVAL_TIMER);
             LWIP_PTP_STOP_TIMER(PDELAYREQ_INTERVAL_TIMER);
@@ -132,6 +158,7 @@ void toState(ptpClock_t *ptpClock, u8_t state)
                 break;
             }
             LWIP_PTP_STOP_TIMER(ANNOUNCE_RECEIPT_TIMER);
+            LWIP_PTP_STOP_TIMER(SYNC_RECEIPT_TIMER);
             switch (ptpClock->portDS.delayMechanism) {
                 case E2E:
                     LWIP_PTP_STOP_TIMER(DELAYREQ_INTERVAL_TIMER);
@@ -143,26 +170,27 @@ void toState(ptpClock_t *ptpClock, u8_t state)
                     /* none */
                     break;
             }
-            initClock(ptpClock);
+            holdoverStart(ptpClock);
+            resetClock(ptpClock);
 
             break;
 
         case PTP_PASSIVE:
 
-            initClock(ptpClock);
+            resetClock(ptpClock);
             LWIP_PTP_STOP_TIMER(PDELAYREQ_INTERVAL_TIMER);
             LWIP_PTP_STOP_TIMER(ANNOUNCE_RECEIPT_TIMER);
             break;
 
         case PTP_LISTENING:
 
-            initClock(ptpClock);
+            resetClock(ptpClock);
             LWIP_PTP_STOP_TIMER(ANNOUNCE_RECEIPT_TIMER);
             break;
 
         case PTP_PRE_MASTER:
 
-            initClock(ptpClock);
+            resetClock(ptpClock);
             LWIP_PTP_STOP_TIMER(QUALIFICATION_TIMEOUT);
             break;
 
@@ -207,7 +235,10 @@ void toState(ptpClock_t *ptpClock, u8_t state)
 
         case PTP_MASTER:
 
-            ptpClock->portDS.logMinDelayReqInterval = DEFAULT_DELAYREQ_INTERVAL; /* it may change during slave state */
+            /* these may have been adopted from the master during slave state */
+            ptpClock->portDS.logMinDelayReqInterval = DEFAULT_DELAYREQ_INTERVAL;
+            ptpClock->portDS.logSyncInterval = ptpClock->rtOpts->syncInterval;
+            ptpClock->portDS.logAnnounceInterval = ptpClock->rtOpts->announceInterval;
             LWIP_PTP_START_TIMER(SYNC_INTERVAL_TIMER, pow2ms(ptpClock->portDS.logSyncInterval));
             DBG("SYNC INTERVAL TIMER : %d \n", pow2ms(ptpClock->portDS.logSyncInterval));
             LWIP_PTP_START_TIMER(ANNOUNCE_INTERVAL_TIMER, pow2ms(ptpClock->portDS.logAnnounceInterval));
@@ -239,7 +270,13 @@ void toState(ptpClock_t *ptpClock, u8_t state)
 
         case PTP_UNCALIBRATED:
 
+            holdoverStop(ptpClock);
             LWIP_PTP_START_TIMER(ANNOUNCE_RECEIPT_TIMER, (ptpClock->portDS.announceReceiptTimeout)*(pow2ms(ptpClock->portDS.logAnnounceInterval)));
+            /* The parent's sync interval is only known from its Syncs, allow
+             * for one as long as its announce interval until then */
+            LWIP_PTP_START_TIMER(SYNC_RECEIPT_TIMER, DEFAULT_SYNC_RECEIPT_TIMEOUT * pow2ms(
+                ptpClock->portDS.logSyncInterval > ptpClock->portDS.logAnnounceInterval ?
+                ptpClock->portDS.logSyncInterval : ptpClock->portDS.logAnnounceInterval));
             switch (ptpClock->portDS.delayMechanism) {
                 case E2E:
                     LWIP_PTP_START_TIMER(DELAYREQ_INTERVAL_TIMER, getRand(pow2ms(ptpClock->portDS.logMinDelayReqInterval + 1)));
@@ -257,6 +294,7 @@ void toState(ptpClock_t *ptpClock, u8_t state)
 
         case PTP_SLAVE:
 
+            holdoverStop(ptpClock);
             ptpClock->portDS.portState = PTP_SLAVE;
 
             break;
@@ -293,6 +331,63 @@ static bool doInit(ptpClock_t *ptpClock)
     }
 }
 
+/*
+ * The application only queues requests, the data sets they change belong to
+ * this thread. Take them all at once so none is half applied.
+ */
+static void handleRequests(ptpClock_t *ptpClock)
+{
+    SYS_ARCH_DECL_PROTECT(lev);
+    ptpRequest_t request;
+#if LWIP_PTP_AUTH
+    int dropped = 0;
+#endif
+
+    if (!ptpClock->request.pending)
+        return;
+
+    SYS_ARCH_PROTECT(lev);
+    request = ptpClock->request;
+    ptpClock->request.pending = 0;
+#if LWIP_PTP_AUTH
+    /* Installed in place, before a signing key that may refer to them */
+    if (getFlag(request.pending, REQUEST_AUTH_KEY))
+        dropped = authInstallQueued(&ptpClock->auth);
+#endif
+    SYS_ARCH_UNPROTECT(lev);
+
+#if LWIP_PTP_AUTH
+    if (dropped) {
+        ERROR("handleRequests: key table full, %d keys dropped\n", dropped);
+    }
+
+    if (getFlag(request.pending, REQUEST_AUTH_TX_KEY)) {
+        if (authSetTxKey(&ptpClock->auth, request.authTxKeyId) != ERR_OK) {
+            ERROR("handleRequests: no key %u to sign with\n", request.authTxKeyId);
+        }
+    }
+#endif
+
+    if (getFlag(request.pending, REQUEST_DELAY_ASYMMETRY)) {
+        DBG("handleRequests: delay asymmetry %d nsec\n", request.delayAsymmetry);
+        nanosecondsToInternalTime(request.delayAsymmetry, &ptpClock->rtOpts->delayAsymmetry);
+        ptpClock->portDS.delayAsymmetry = ptpClock->rtOpts->delayAsymmetry;
+        ptpClock->asymmetry_filt.n = 0;
+    }
+
+    if (getFlag(request.pending, REQUEST_SERVO)) {
+        ptpClock->rtOpts->servo.type = request.servoType;
+        if (ptpClock->servoOps && ptpClock->servoOps->type != request.servoType)
+            servoChange(ptpClock, request.servoType);
+    }
+
+    if (getFlag(request.pending, REQUEST_CALIBRATE_ASYMMETRY)) {
+        if (!calibrateAsymmetry(ptpClock, request.calibrationOffset)) {
+            DBG("handleRequests: asymmetry calibration not possible\n");
+        }
+    }
+}
+
 /**
  * \brief Run PTP stack in current state
  * Handle actions and events for 'port_state'
@@ -301,6 +396,10 @@ void doState(ptpClock_t *ptpClock)
 {
     ptpClock->messageActivity = false;
 
+    handleRequests(ptpClock);
+    holdoverUpdate(ptpClock);
+    tempUpdate(ptpClock);
+
     switch (ptpClock->portDS.portState) {
         case PTP_LISTENING:
         case PTP_UNCALIBRATED:
@@ -367,6 +466,7 @@ void doState(ptpClock_t *ptpClock)
                     if (getFlag(ptpClock->events, MASTER_CLOCK_CHANGED)) {
                         DBG("event MASTER_CLOCK_CHANGED\n");
                         clearFlag(ptpClock->events, MASTER_CLOCK_CHANGED);
+                        resetClock(ptpClock);
                     }
 
                     break;
@@ -382,7 +482,12 @@ void doState(ptpClock_t *ptpClock)
                     if (getFlag(ptpClock->events, MASTER_CLOCK_CHANGED)) {
                         DBG("event MASTER_CLOCK_CHANGED\n");
                         clearFlag(ptpClock->events, MASTER_CLOCK_CHANGED);
-                        toState(ptpClock, PTP_UNCALIBRATED);
+
+                        /* Failover to a hot standby keeps the servo locked */
+                        if (!standbySwitch(ptpClock)) {
+                            resetClock(ptpClock);
+                            toState(ptpClock, PTP_UNCALIBRATED);
+                        }
                     }
 
                     break;
@@ -441,8 +546,17 @@ void doState(ptpClock_t *ptpClock)
 
             if (LWIP_PTP_CHECK_TIMER(ANNOUNCE_RECEIPT_TIMER)) {
                 DBGV("event ANNOUNCE_RECEIPT_TIMEOUT_EXPIRES for state %s\n", stateString(ptpClock->portDS.portState));
-                ptpClock->foreignMasterDS.count = 0;
-                ptpClock->foreignMasterDS.i = 0;
+
+                /* Only the parent is gone, let the BMC hand over to the standby */
+                if (ptpClock->portDS.portState == PTP_SLAVE && standbyReady(ptpClock)) {
+                    DBG("announce receipt timeout, failing over to the standby master\n");
+                    foreignForget(ptpClock, &ptpClock->parentDS.parentPortIdentity);
+                    setFlag(ptpClock->events, STATE_DECISION_EVENT);
+                    LWIP_PTP_START_TIMER(ANNOUNCE_RECEIPT_TIMER, (ptpClock->portDS.announceReceiptTimeout) * (pow2ms(ptpClock->portDS.logAnnounceInterval)));
+                    break;
+                }
+
+                foreignClear(ptpClock);
 
                 if (!(ptpClock->defaultDS.slaveOnly || ptpClock->defaultDS.clockQuality.clockClass == 255)) {
                     m1(ptpClock);
@@ -457,6 +571,12 @@ void doState(ptpClock_t *ptpClock)
                 break;
             }
 
+            if ((ptpClock->portDS.portState == PTP_UNCALIBRATED || ptpClock->portDS.portState == PTP_SLAVE) &&
+                LWIP_PTP_CHECK_TIMER(SYNC_RECEIPT_TIMER)) {
+                DBGV("event SYNC_RECEIPT_TIMEOUT_EXPIRES for state %s\n", stateString(ptpClock->portDS.portState));
+                syncReceiptTimeout(ptpClock);
+            }
+
             handle(ptpClock);
 
             break;
@@ -559,13 +679,22 @@ static void handle(ptpClock_t *ptpClock)
         return;
     }
 
+#if LWIP_PTP_AUTH
+    /* Annex P - nothing is acted upon before its ICV has been checked */
+    if (!authVerify(&ptpClock->auth, ptpClock->msgIbuf, ptpClock->msgIbufLength, &ptpClock->msgTmpHeader)) {
+        DBGV("handle: drop unauthenticated message type %d\n", ptpClock->msgTmpHeader.messageType);
+        return;
+    }
+#endif
+
     /* Spec 9.5.2.2 */
     isFromSelf = isSamePortIdentity(
     &ptpClock->portDS.portIdentity,
     &ptpClock->msgTmpHeader.sourcePortIdentity);
 
     /* Subtract the inbound latency adjustment if it is not a loop back and the
-            time stamp seems reasonable */
+            time stamp seems reasonable. The latencies place our timestamps
+            at the wire, the path itself is corrected with delayAsymmetry */
     if (!isFromSelf && time.seconds > 0)
         subTime(&time, &time, &ptpClock->inboundLatency);
 
@@ -617,6 +746,147 @@ static void handle(ptpClock_t *ptpClock)
     }
 }
 
+/*
+ * The logMessageInterval of Sync, Announce and Delay_Resp from the parent
+ * (Table 24) replaces our own value while we are its slave. Returns true if
+ * the interval changed; 0x7F (unicast, unspecified) and values outside
+ * LOG_INTERVAL_MIN..LOG_INTERVAL_MAX are ignored.
+ */
+static bool adoptInterval(s8_t *interval, s8_t advertised)
+{
+    if (advertised < LOG_INTERVAL_MIN || advertised > LOG_INTERVAL_MAX || advertised == *interval)
+        return false;
+
+    *interval = advertised;
+    return true;
+}
+
+/* A slave follows the Syncs of the BMC runner-up as a hot standby */
+static bool isFromStandby(const ptpClock_t *ptpClock)
+{
+    const portIdentity_t *runnerUp = bmcRunnerUp(ptpClock);
+
+    return runnerUp && isSamePortIdentity(runnerUp, &ptpClock->msgTmpHeader.sourcePortIdentity);
+}
+
+/*
+ * Sequence ids of the parent's Syncs count up by one (7.3.7). A gap is
+ * counted as missing Syncs; a repeated or older Sync is counted and dropped,
+ * its Follow_Up would pair with the wrong Sync. Half the sequence space
+ * decides between late and far ahead.
+ */
+static bool syncSequence(ptpClock_t *ptpClock)
+{
+    syncReceipt_t *sr = &ptpClock->syncReceipt;
+    u16_t diff = (u16_t)(ptpClock->msgTmpHeader.sequenceId - sr->sequenceId);
+
+    if (sr->valid) {
+        if (diff == 0) {
+            sr->duplicate++;
+            DBGV("handleSync: duplicate sequenceId %d\n", sr->sequenceId);
+            return false;
+        }
+        if (diff >= 0x8000) {
+            sr->outOfOrder++;
+            DBGV("handleSync: sequenceId %d older than %d\n", (u16_t)ptpClock->msgTmpHeader.sequenceId, sr->sequenceId);
+            return false;
+        }
+        sr->missing += diff - 1;
+    }
+
+    sr->sequenceId = (u16_t)ptpClock->msgTmpHeader.sequenceId;
+    sr->valid = true;
+    return true;
+}
+
+/* A Sync from the parent gave an offset, its Syncs are flowing */
+static void syncReceived(ptpClock_t *ptpClock)
+{
+    holdoverStop(ptpClock);
+    LWIP_PTP_START_TIMER(SYNC_RECEIPT_TIMER, DEFAULT_SYNC_RECEIPT_TIMEOUT * pow2ms(ptpClock->portDS.logSyncInterval));
+}
+
+/*
+ * The parent still announces but no usable Sync came for
+ * DEFAULT_SYNC_RECEIPT_TIMEOUT sync intervals, e.g. a broken event path or
+ * lost receive timestamps. Mark it sync-faulted for another qualified master
+ * if there is one (through the hot standby if that is ready): its Announce
+ * messages keep its record but it no longer qualifies, so it cannot win
+ * again until one of its Syncs gives an offset. Otherwise hold the frequency in
+ * UNCALIBRATED rather than stay in SLAVE with a stale servo, until its Syncs
+ * come back.
+ */
+static void syncReceiptTimeout(ptpClock_t *ptpClock)
+{
+    ptpClock->syncReceipt.timeouts++;
+    ptpClock->waitingForFollowUp = false;
+
+    if (bmcRunnerUp(ptpClock)) {
+        DBG("sync receipt timeout, selecting another master\n");
+        foreignSyncFault(ptpClock, &ptpClock->parentDS.parentPortIdentity, true);
+        setFlag(ptpClock->events, STATE_DECISION_EVENT);
+    }
+    else if (ptpClock->portDS.portState == PTP_SLAVE) {
+        DBG("sync receipt timeout, holding over\n");
+        toState(ptpClock, PTP_UNCALIBRATED);
+        holdoverStart(ptpClock);
+        resetClock(ptpClock);
+    }
+
+    LWIP_PTP_START_TIMER(SYNC_RECEIPT_TIMER, DEFAULT_SYNC_RECEIPT_TIMEOUT * pow2ms(ptpClock->portDS.logSyncInterval));
+}
+
+/*
+ * A sync-faulted master qualifies again once a Sync of it gives an offset,
+ * with its Follow_Up if it is two step, as a sample of the hot standby
+ * would. Its Syncs alone, without timestamps or Follow_Ups, are not enough.
+ */
+static void faultedSync(ptpClock_t *ptpClock, const timeInternal_t *time)
+{
+    syncFaultProbe_t *probe = &ptpClock->syncFaultProbe;
+    timeInternal_t originTimestamp;
+    timeInternal_t correctionField;
+
+    if (!foreignSyncFaulted(ptpClock, &ptpClock->msgTmpHeader.sourcePortIdentity))
+        return;
+
+    scaledNanosecondsToInternalTime(&ptpClock->msgTmpHeader.correctionfield, &correctionField);
+    addTime(&correctionField, &correctionField, &ptpClock->portDS.delayAsymmetry);
+
+    if (getFlag(ptpClock->msgTmpHeader.flagField[0], FLAG0_TWO_STEP)) {
+        probe->portIdentity = ptpClock->msgTmpHeader.sourcePortIdentity;
+        probe->syncSequenceId = ptpClock->msgTmpHeader.sequenceId;
+        probe->syncIngress = *time;
+        probe->correctionSync = correctionField;
+        probe->waitingForFollowUp = true;
+        return;
+    }
+
+    msgUnpackSync(ptpClock->msgIbuf, &ptpClock->msgTmp.sync);
+    toInternalTime(&originTimestamp, &ptpClock->msgTmp.sync.originTimestamp);
+    if (syncFaultSync(ptpClock, &ptpClock->msgTmpHeader, time, &originTimestamp, &correctionField))
+        setFlag(ptpClock->events, STATE_DECISION_EVENT);
+}
+
+static void faultedFollowUp(ptpClock_t *ptpClock)
+{
+    syncFaultProbe_t *probe = &ptpClock->syncFaultProbe;
+    timeInternal_t preciseOriginTimestamp;
+    timeInternal_t correctionField;
+
+    if (probe->syncSequenceId != ptpClock->msgTmpHeader.sequenceId ||
+            !isSamePortIdentity(&probe->portIdentity, &ptpClock->msgTmpHeader.sourcePortIdentity))
+        return;
+
+    probe->waitingForFollowUp = false;
+    msgUnpackFollowUp(ptpClock->msgIbuf, &ptpClock->msgTmp.follow);
+    toInternalTime(&preciseOriginTimestamp, &ptpClock->msgTmp.follow.preciseOriginTimestamp);
+    scaledNanosecondsToInternalTime(&ptpClock->msgTmpHeader.correctionfield, &correctionField);
+    addTime(&correctionField, &correctionField, &probe->correctionSync);
+    if (syncFaultSync(ptpClock, &ptpClock->msgTmpHeader, &probe->syncIngress, &preciseOriginTimestamp, &correctionField))
+        setFlag(ptpClock->events, STATE_DECISION_EVENT);
+}
+
 /* Handle announce messages - spec 9.5.3 */
 static void handleAnnounce(ptpClock_t *ptpClock, bool isFromSelf)
 {
@@ -654,15 +924,19 @@ static void handleAnnounce(ptpClock_t *ptpClock, bool isFromSelf)
             msgUnpackAnnounce(ptpClock->msgIbuf, &ptpClock->msgTmp.announce);
             if (isFromCurrentParent) {
                     s1(ptpClock, &ptpClock->msgTmpHeader, &ptpClock->msgTmp.announce);
+                    if (adoptInterval(&ptpClock->portDS.logAnnounceInterval, ptpClock->msgTmpHeader.logMessageInterval)) {
+                        DBG("handleAnnounce: master announce interval 2^%d s\n", ptpClock->portDS.logAnnounceInterval);
+                    }
                     /* Reset  Timer handling Announce receipt timeout */
                     LWIP_PTP_START_TIMER(ANNOUNCE_RECEIPT_TIMER, (ptpClock->portDS.announceReceiptTimeout) * (pow2ms(ptpClock->portDS.logAnnounceInterval)));
             }
             else {
                 DBGV("handleAnnounce: from another foreign master\n");
-                /* addForeign takes care  of AnnounceUnpacking */
-                addForeign(ptpClock, &ptpClock->msgTmpHeader, &ptpClock->msgTmp.announce);
             }
 
+            /* The parent is a foreign master too, it has to stay qualified */
+            addForeign(ptpClock, &ptpClock->msgTmpHeader, &ptpClock->msgTmp.announce);
+
             break;
 
         case PTP_PASSIVE:
@@ -699,6 +973,10 @@ static void handleSync(ptpClock_t *ptpClock, timeInternal_t *time, bool isFromSe
         return;
     }
 
+    /* A master dropped for its missing Syncs may qualify again */
+    if (ptpClock->foreignMasterDS.syncFaults > 0 && !isFromSelf)
+        faultedSync(ptpClock, time);
+
     switch (ptpClock->portDS.portState) {
         case PTP_INITIALIZING:
         case PTP_FAULTY:
@@ -719,14 +997,46 @@ static void handleSync(ptpClock_t *ptpClock, timeInternal_t *time, bool isFromSe
             &ptpClock->parentDS.parentPortIdentity,
             &ptpClock->msgTmpHeader.sourcePortIdentity);
 
-            if (!isFromCurrentParent) {
+            if (!isFromCurrentParent && !isFromStandby(ptpClock)) {
                 DBGV("handleSync: ignore from another master\n");
                 break;
             }
 
+            if (!isFromCurrentParent) {
+                DBGV("handleSync: from the standby master\n");
+                scaledNanosecondsToInternalTime(&ptpClock->msgTmpHeader.correctionfield, &correctionField);
+                addTime(&correctionField, &correctionField, &ptpClock->portDS.delayAsymmetry);
+
+                if (getFlag(ptpClock->msgTmpHeader.flagField[0], FLAG0_TWO_STEP)) {
+                    ptpClock->standby.waitingForFollowUp = true;
+                    ptpClock->standby.syncSequenceId = ptpClock->msgTmpHeader.sequenceId;
+                    ptpClock->standby.syncIngress = *time;
+                    ptpClock->standby.correctionSync = correctionField;
+                }
+                else {
+                    msgUnpackSync(ptpClock->msgIbuf, &ptpClock->msgTmp.sync);
+                    ptpClock->standby.waitingForFollowUp = false;
+                    toInternalTime(&originTimestamp, &ptpClock->msgTmp.sync.originTimestamp);
+                    standbySync(ptpClock, &ptpClock->msgTmpHeader, time, &originTimestamp, &correctionField);
+                }
+                break;
+            }
+
+            if (!syncSequence(ptpClock))
+                break;
+
+            /* the servos scale their gains with the sync interval in use */
+            if (adoptInterval(&ptpClock->portDS.logSyncInterval, ptpClock->msgTmpHeader.logMessageInterval)) {
+                DBG("handleSync: master sync interval 2^%d s\n", ptpClock->portDS.logSyncInterval);
+            }
+
             ptpClock->timestamp_syncRecieve = *time;
             scaledNanosecondsToInternalTime(&ptpClock->msgTmpHeader.correctionfield, &correctionField);
 
+            /* 11.6.2 - the Sync took delayAsymmetry longer than the mean
+             * path delay, a two step Follow_Up adds its own correction */
+            addTime(&correctionField, &correctionField, &ptpClock->portDS.delayAsymmetry);
+
             if (getFlag(ptpClock->msgTmpHeader.flagField[0], FLAG0_TWO_STEP)) {
                 ptpClock->waitingForFollowUp = true;
                 ptpClock->recvSyncSequenceId = ptpClock->msgTmpHeader.sequenceId;
@@ -739,8 +1049,10 @@ static void handleSync(ptpClock_t *ptpClock, timeInternal_t *time, bool isFromSe
                 /* Synchronize  local clock */
                 toInternalTime(&originTimestamp, &ptpClock->msgTmp.sync.originTimestamp);
                 /* use correctionField of Sync message for future use */
-                updateOffset(ptpClock, &ptpClock->timestamp_syncRecieve, &originTimestamp, &correctionField);
-                updateClock(ptpClock);
+                if (updateOffset(ptpClock, &ptpClock->timestamp_syncRecieve, &originTimestamp, &correctionField)) {
+                    syncReceived(ptpClock);
+                    updateClock(ptpClock);
+                }
                 issueDelayReqTimerExpired(ptpClock);
             }
 
@@ -800,6 +1112,9 @@ static void handleFollowUp(ptpClock_t *ptpClock, bool isFromSelf)
         return;
     }
 
+    if (ptpClock->syncFaultProbe.waitingForFollowUp)
+        faultedFollowUp(ptpClock);
+
     switch (ptpClock->portDS.portState) {
         case PTP_INITIALIZING:
         case PTP_FAULTY:
@@ -816,6 +1131,22 @@ static void handleFollowUp(ptpClock_t *ptpClock, bool isFromSelf)
             &ptpClock->parentDS.parentPortIdentity,
             &ptpClock->msgTmpHeader.sourcePortIdentity);
 
+            if (!isFromCurrentParent && isFromStandby(ptpClock)) {
+                if (!ptpClock->standby.waitingForFollowUp || ptpClock->standby.syncSequenceId != ptpClock->msgTmpHeader.sequenceId) {
+                    DBGV("handleFollowup: doesn't match with the standby Sync\n");
+                    break;
+                }
+
+                msgUnpackFollowUp(ptpClock->msgIbuf, &ptpClock->msgTmp.follow);
+
+                ptpClock->standby.waitingForFollowUp = false;
+                toInternalTime(&preciseOriginTimestamp, &ptpClock->msgTmp.follow.preciseOriginTimestamp);
+                scaledNanosecondsToInternalTime(&ptpClock->msgTmpHeader.correctionfield, &correctionField);
+                addTime(&correctionField, &correctionField, &ptpClock->standby.correctionSync);
+                standbySync(ptpClock, &ptpClock->msgTmpHeader, &ptpClock->standby.syncIngress, &preciseOriginTimestamp, &correctionField);
+                break;
+            }
+
             if (!ptpClock->waitingForFollowUp) {
                 DBGV("handleFollowup: not waiting a message\n");
                 break;
@@ -838,8 +1169,10 @@ static void handleFollowUp(ptpClock_t *ptpClock, bool isFromSelf)
             toInternalTime(&preciseOriginTimestamp, &ptpClock->msgTmp.follow.preciseOriginTimestamp);
             scaledNanosecondsToInternalTime(&ptpClock->msgTmpHeader.correctionfield, &correctionField);
             addTime(&correctionField, &correctionField, &ptpClock->correctionField_sync);
-            updateOffset(ptpClock, &ptpClock->timestamp_syncRecieve, &preciseOriginTimestamp, &correctionField);
-            updateClock(ptpClock);
+            if (updateOffset(ptpClock, &ptpClock->timestamp_syncRecieve, &preciseOriginTimestamp, &correctionField)) {
+                syncReceived(ptpClock);
+                updateClock(ptpClock);
+            }
 
             issueDelayReqTimerExpired(ptpClock);
             break;
@@ -916,6 +1249,11 @@ static void handleDelayReq(ptpClock_t *ptpClock, timeInternal_t *time, bool isFr
             ERROR("handleDelayReq: disreguard in P2P mode\n");
             break;
 
+        case DELAY_DISABLED:
+
+            DBGV("handleDelayReq: disreguard, delay mechanism disabled\n");
+            break;
+
         default:
 
             /* none */
@@ -930,6 +1268,7 @@ static void handleDelayResp(ptpClock_t *ptpClock, bool  isFromSelf)
     bool isFromCurrentParent = false;
     bool isCurrentRequest = false;
     timeInternal_t correctionField;
+    timeInternal_t receiveTimestamp;
 
     switch (ptpClock->portDS.delayMechanism)
     {
@@ -968,9 +1307,21 @@ static void handleDelayResp(ptpClock_t *ptpClock, bool  isFromSelf)
                         toInternalTime(&ptpClock->timestamp_delayReqRecieve, &ptpClock->msgTmp.resp.receiveTimestamp);
 
                         scaledNanosecondsToInternalTime(&ptpClock->msgTmpHeader.correctionfield, &correctionField);
+
+                        /* 11.6.3 - and the Delay_Req that much shorter */
+                        subTime(&correctionField, &correctionField, &ptpClock->portDS.delayAsymmetry);
                         updateDelay(ptpClock, &ptpClock->timestamp_delayReqSend, &ptpClock->timestamp_delayReqRecieve, &correctionField);
 
-                        ptpClock->portDS.logMinDelayReqInterval = ptpClock->msgTmpHeader.logMessageInterval;
+                        if (adoptInterval(&ptpClock->portDS.logMinDelayReqInterval, ptpClock->msgTmpHeader.logMessageInterval)) {
+                            DBG("handleDelayResp: master delay request interval 2^%d s\n", ptpClock->portDS.logMinDelayReqInterval);
+                        }
+                    }
+                    else if (((ptpClock->sentDelayReqSequenceId - 1) == ptpClock->msgTmpHeader.sequenceId) && isCurrentRequest && isFromStandby(ptpClock)) {
+                        /* The runner-up answers the same multicast Delay_Req */
+                        toInternalTime(&receiveTimestamp, &ptpClock->msgTmp.resp.receiveTimestamp);
+                        scaledNanosecondsToInternalTime(&ptpClock->msgTmpHeader.correctionfield, &correctionField);
+                        subTime(&correctionField, &correctionField, &ptpClock->portDS.delayAsymmetry);
+                        standbyDelay(ptpClock, &ptpClock->timestamp_delayReqSend, &receiveTimestamp, &correctionField);
                     }
                     else {
                         DBGV("handleDelayResp: doesn't match with the delayReq\n");
@@ -984,6 +1335,11 @@ static void handleDelayResp(ptpClock_t *ptpClock, bool  isFromSelf)
             ERROR("handleDelayResp: disreguard in P2P mode\n");
             break;
 
+        case DELAY_DISABLED:
+
+            DBGV("handleDelayResp: disreguard, delay mechanism disabled\n");
+            break;
+
         default:
 
             break;
@@ -1267,13 +1623,29 @@ static void issueDelayReqTimerExpired(ptpClock_t *ptpClock)
     }
 }
 
+/* Append the trailing TLVs to a packed outgoing message */
+static s16_t appendTlvs(ptpClock_t *ptpClock, s16_t length)
+{
+#if LWIP_PTP_AUTH
+    /* AUTHENTICATION TLV is always the last one (16.14.1) */
+    length = authAppendTlv(&ptpClock->auth, ptpClock->msgObuf, length);
+#else
+    UNUSED(ptpClock);
+#endif
+
+    return length;
+}
+
 /* Pack and send on general multicast ip adress an Announce message */
 static void issueAnnounce(ptpClock_t *ptpClock)
 {
+    s16_t length;
+
     msgPackAnnounce(ptpClock, ptpClock->msgObuf);
+    length = appendTlvs(ptpClock, ANNOUNCE_LENGTH);
 
     /// @todo network code!
-    if (!netSendGeneral(&ptpClock->netPath, ptpClock->msgObuf, ANNOUNCE_LENGTH)) {
+    if (!netSendGeneral(&ptpClock->netPath, ptpClock->msgObuf, length)) {
         ERROR("issueAnnounce: can't sent\n");
         toState(ptpClock, PTP_FAULTY);
     }
@@ -1288,14 +1660,16 @@ static void issueSync(ptpClock_t *ptpClock)
 {
     timestamp_t originTimestamp;
     timeInternal_t internalTime;
+    s16_t length;
 
     /* try to predict outgoing time stamp */
     getTime(&internalTime);
     fromInternalTime(&internalTime, &originTimestamp);
     msgPackSync(ptpClock, ptpClock->msgObuf, &originTimestamp);
+    length = appendTlvs(ptpClock, SYNC_LENGTH);
 
     /// @todo network code!
-    if (!netSendEvent(&ptpClock->netPath, ptpClock->msgObuf, SYNC_LENGTH, &internalTime)) {
+    if (!netSendEvent(&ptpClock->netPath, ptpClock->msgObuf, length, &internalTime)) {
         ERROR("issueSync: can't sent\n");
         toState(ptpClock, PTP_FAULTY);
     }
@@ -1319,12 +1693,14 @@ static void issueSync(ptpClock_t *ptpClock)
 static void issueFollowup(ptpClock_t *ptpClock, const timeInternal_t *time)
 {
     timestamp_t preciseOriginTimestamp;
+    s16_t length;
 
     fromInternalTime(time, &preciseOriginTimestamp);
     msgPackFollowUp(ptpClock, ptpClock->msgObuf, &preciseOriginTimestamp);
+    length = appendTlvs(ptpClock, FOLLOW_UP_LENGTH);
 
     /// @todo network code!
-    if (!netSendGeneral(&ptpClock->netPath, ptpClock->msgObuf, FOLLOW_UP_LENGTH)) {
+    if (!netSendGeneral(&ptpClock->netPath, ptpClock->msgObuf, length)) {
         ERROR("issueFollowup: can't sent\n");
         toState(ptpClock, PTP_FAULTY);
     }
@@ -1339,14 +1715,16 @@ static void issueDelayReq(ptpClock_t *ptpClock)
 {
     timestamp_t originTimestamp;
     timeInternal_t internalTime;
+    s16_t length;
 
     getTime(&internalTime);
     fromInternalTime(&internalTime, &originTimestamp);
 
     msgPackDelayReq(ptpClock, ptpClock->msgObuf, &originTimestamp);
+    length = appendTlvs(ptpClock, DELAY_REQ_LENGTH);
 
     /// @todo network code!
-    if (!netSendEvent(&ptpClock->netPath, ptpClock->msgObuf, DELAY_REQ_LENGTH, &internalTime)) {
+    if (!netSendEvent(&ptpClock->netPath, ptpClock->msgObuf, length, &internalTime)) {
         ERROR("issueDelayReq: can't send\n");
         toState(ptpClock, PTP_FAULTY);
     }
@@ -1367,12 +1745,14 @@ static void issueDelayResp(ptpClock_t *ptpClock, const timeInternal_t *time,
                                             const msgHeader_t *delayReqHeader)
 {
     timestamp_t requestReceiptTimestamp;
+    s16_t length;
 
     fromInternalTime(time, &requestReceiptTimestamp);
     msgPackDelayResp(ptpClock, ptpClock->msgObuf, delayReqHeader, &requestReceiptTimestamp);
+    length = appendTlvs(ptpClock, DELAY_RESP_LENGTH);
 
     /// @todo network code!
-    if (!netSendGeneral(&ptpClock->netPath, ptpClock->msgObuf, PDELAY_RESP_LENGTH)) {
+    if (!netSendGeneral(&ptpClock->netPath, ptpClock->msgObuf, length)) {
         ERROR("issueDelayResp: can't sent\n");
         toState(ptpClock, PTP_FAULTY);
     }
@@ -1386,14 +1766,16 @@ static void issuePDelayReq(ptpClock_t *ptpClock)
 {
     timestamp_t originTimestamp;
     timeInternal_t internalTime;
+    s16_t length;
 
     getTime(&internalTime);
     fromInternalTime(&internalTime, &originTimestamp);
 
     msgPackPDelayReq(ptpClock, ptpClock->msgObuf, &originTimestamp);
+    length = appendTlvs(ptpClock, PDELAY_REQ_LENGTH);
 
     /// @todo network code!
-    if (!netSendPeerEvent(&ptpClock->netPath, ptpClock->msgObuf, PDELAY_REQ_LENGTH, &internalTime)) {
+    if (!netSendPeerEvent(&ptpClock->netPath, ptpClock->msgObuf, length, &internalTime)) {
         ERROR("issuePDelayReq: can't sent\n");
         toState(ptpClock, PTP_FAULTY);
     }
@@ -1414,12 +1796,14 @@ static void issuePDelayResp(ptpClock_t *ptpClock, timeInternal_t *time,
                                             const msgHeader_t *pDelayReqHeader)
 {
     timestamp_t requestReceiptTimestamp;
+    s16_t length;
 
     fromInternalTime(time, &requestReceiptTimestamp);
     msgPackPDelayResp(ptpClock->msgObuf, pDelayReqHeader, &requestReceiptTimestamp);
+    length = appendTlvs(ptpClock, PDELAY_RESP_LENGTH);
 
     /// @todo network code!
-    if (!netSendPeerEvent(&ptpClock->netPath, ptpClock->msgObuf, PDELAY_RESP_LENGTH, time)) {
+    if (!netSendPeerEvent(&ptpClock->netPath, ptpClock->msgObuf, length, time)) {
         ERROR("issuePDelayResp: can't sent\n");
         toState(ptpClock, PTP_FAULTY);
     }
@@ -1438,12 +1822,15 @@ static void issuePDelayRespFollowUp(ptpClock_t *ptpClock, const timeInternal_t *
                                                     const msgHeader_t *pDelayReqHeader)
 {
     timestamp_t responseOriginTimestamp;
+    s16_t length;
+
     fromInternalTime(time, &responseOriginTimestamp);
 
     msgPackPDelayRespFollowUp(ptpClock->msgObuf, pDelayReqHeader, &responseOriginTimestamp);
+    length = appendTlvs(ptpClock, PDELAY_RESP_FOLLOW_UP_LENGTH);
 
     /// @todo network code!
-    if (!netSendPeerGeneral(&ptpClock->netPath, ptpClock->msgObuf, PDELAY_RESP_FOLLOW_UP_LENGTH)) {
+    if (!netSendPeerGeneral(&ptpClock->netPath, ptpClock->msgObuf, length)) {
         ERROR("issuePDelayRespFollowUp: can't sent\n");
         toState(ptpClock, PTP_FAULTY);
     }
@@ -3,11 +3,27 @@
 #if LWIP_PTP || defined __DOXYGEN__
 
 #include <stdlib.h>
+#include <string.h>
+
+#include <lwip/sys.h>
 
 #include "arith.h"
+#include "bmc.h"
 #include "net.h"
+#include "stability.h"
 #include "sys_time.h"
 
+/* Servos may shift the clock directly when the driver supports it */
+#if defined LWIP_PTP_ADJ_PHASE
+#define PHASE_ADJUST    1
+#else
+#define PHASE_ADJUST    0
+#endif
+
+/* Largest value (ns) the exponential filter takes and its highest order */
+#define FILTER_MAX_NS   1000000000
+#define FILTER_MAX_S    30
+
 /**
  * \brief return maximum of two numbers
  */
@@ -24,32 +40,290 @@ static inline s32_t min(s32_t a, s32_t b)
     return a > b ? b : a;
 }
 
+/* Return the servo implementing 'type', falls back to the PI servo */
+const servoOps_t *servoSelect(u8_t type)
+{
+    switch (type) {
+        case SERVO_PI:
+            return &servoPi;
+
+#if LWIP_PTP_SERVO_LINREG
+        case SERVO_LINREG:
+            return &servoLinreg;
+#endif
+
+#if LWIP_PTP_SERVO_KALMAN
+        case SERVO_KALMAN:
+            return &servoKalman;
+#endif
+
+        default:
+            ERROR("servoSelect: servo %d not available, using PI\n", type);
+            return &servoPi;
+    }
+}
+
+bool servoAvailable(u8_t type)
+{
+    switch (type) {
+        case SERVO_PI:
+#if LWIP_PTP_SERVO_LINREG
+        case SERVO_LINREG:
+#endif
+#if LWIP_PTP_SERVO_KALMAN
+        case SERVO_KALMAN:
+#endif
+            return true;
+
+        default:
+            return false;
+    }
+}
+
+/* The new servo has no phase history but takes over the frequency */
+void servoChange(ptpClock_t *ptpClock, u8_t type)
+{
+    s32_t drift = ptpClock->observedDrift;
+
+    DBG("servoChange: servo %d -> %d\n", ptpClock->servoOps->type, type);
+
+    ptpClock->servo.type = type;
+    ptpClock->servoOps = servoSelect(type);
+    ptpClock->servoOps->init(ptpClock);
+    ptpClock->observedDrift = drift;
+    ptpClock->servoOps->reset(ptpClock);
+}
+
+/* Clear a packet selection window */
+static void minWindowInit(minWindow_t *win, u8_t window)
+{
+    win->head = 0;
+    win->count = 0;
+    win->n = 0;
+    win->window = window;
+}
+
+/* Lucky packet selection (G.8265.1): replace a delay sample with the
+ * smallest of the last win->window samples, queueing only ever adds delay */
+static void minWindow(s32_t *nsec_current, minWindow_t *win)
+{
+    u8_t tail;
+
+    win->n++;
+
+    /* Drop the minimum once it falls out of the window */
+    if (win->count > 0 && win->n - win->index[win->head] >= win->window) {
+        win->head = (win->head + 1) % DELAY_WINDOW_MAX;
+        win->count--;
+    }
+
+    /* Drop samples which can no longer be the minimum */
+    while (win->count > 0) {
+        tail = (win->head + win->count - 1) % DELAY_WINDOW_MAX;
+        if (win->value[tail] < *nsec_current)
+            break;
+        win->count--;
+    }
+
+    tail = (win->head + win->count) % DELAY_WINDOW_MAX;
+    win->value[tail] = *nsec_current;
+    win->index[tail] = win->n;
+    win->count++;
+
+    DBGV("minWindow: %d -> %d\n", *nsec_current, win->value[win->head]);
+
+    *nsec_current = win->value[win->head];
+}
+
+/* Clear the outlier gate history, the counters are kept */
+static void outlierInit(outlierGate_t *gate)
+{
+    gate->head = 0;
+    gate->count = 0;
+    gate->consecutive = 0;
+}
+
+/* Median of n values, sorts the array in place */
+static s32_t median(s32_t *values, int n)
+{
+    int i, j;
+    s32_t v;
+
+    for (i = 1; i < n; i++) {
+        v = values[i];
+        for (j = i; j > 0 && values[j - 1] > v; j--) {
+            values[j] = values[j - 1];
+        }
+        values[j] = v;
+    }
+
+    return values[n / 2];
+}
+
+/* Returns false if the offset lies too far from the median of the recent
+ * offsets, measured in median absolute deviations (MAD). Persistent
+ * rejections mean the offset really moved, the gate then starts over. */
+static bool outlierCheck(outlierGate_t *gate, s64_t offset)
+{
+    s32_t sorted[OUTLIER_WINDOW];
+    s32_t med, mad, limit, value;
+    s64_t dev;
+    int i;
+
+    /* Saturate, anything that far out is rejected anyway */
+    if (offset > INT32_MAX)
+        value = INT32_MAX;
+    else if (offset < -INT32_MAX)
+        value = -INT32_MAX;
+    else
+        value = (s32_t)offset;
+
+    if (gate->count >= OUTLIER_MIN_SAMPLES) {
+        for (i = 0; i < gate->count; i++) {
+            sorted[i] = gate->samples[i];
+        }
+        med = median(sorted, gate->count);
+
+        for (i = 0; i < gate->count; i++) {
+            dev = llabs((s64_t)gate->samples[i] - med);
+            sorted[i] = dev > INT32_MAX ? INT32_MAX : (s32_t)dev;
+        }
+        mad = median(sorted, gate->count);
+
+        limit = max(OUTLIER_MIN_NS, mad > INT32_MAX / OUTLIER_MAD_K ? INT32_MAX : mad * OUTLIER_MAD_K);
+
+        if (offset - med > limit || med - offset > limit) {
+            gate->rejected++;
+            if (++gate->consecutive < OUTLIER_MAX_REJECT) {
+                DBG("outlierCheck: rejected offset %d (median %d, MAD %d)\n", value, med, mad);
+                return false;
+            }
+
+            DBG("outlierCheck: %d consecutive outliers, restarting\n", gate->consecutive);
+            gate->resets++;
+            outlierInit(gate);
+        }
+    }
+
+    gate->consecutive = 0;
+    gate->samples[gate->head] = value;
+    gate->head = (gate->head + 1) % OUTLIER_WINDOW;
+    if (gate->count < OUTLIER_WINDOW)
+        gate->count++;
+
+    return true;
+}
+
+/* Drift to apply after 'elapsed' seconds of holdover (ppb) */
+static s32_t holdoverDrift(const ptpClock_t *ptpClock, u32_t elapsed);
+
+/* Temperature feed-forward for the last reading (scaled ppb) */
+static s64_t tempFeedForward(const ptpClock_t *ptpClock)
+{
+    const tempComp_t *tc = &ptpClock->tempComp;
+    s64_t ff;
+
+    if (!tc->valid || !tc->reading)
+        return 0;
+
+    ff = tc->coeff * (tc->temperature - tc->reference);
+    if (ff > ADJ_FREQ_MAX_SCALED)
+        ff = ADJ_FREQ_MAX_SCALED;
+    else if (ff < -ADJ_FREQ_MAX_SCALED)
+        ff = -ADJ_FREQ_MAX_SCALED;
+
+    return ff;
+}
+
+/* Correct the clock frequency by 'adj' (scaled ppb, the sign of
+ * observedDrift) plus the temperature feed-forward */
+static void setFreq(ptpClock_t *ptpClock, s64_t adj)
+{
+    ptpClock->tempComp.base = adj;
+    ptpClock->tempComp.applied = tempFeedForward(ptpClock);
+    adjFreq(-(adj + ptpClock->tempComp.applied));
+}
+
+/* Restart the rate measurement of the syntonization only mode */
+static void syntonizeReset(ptpClock_t *ptpClock)
+{
+    syntonize_t *syn = &ptpClock->syntonize;
+
+    syn->rate_filt.n = 0;
+    syn->rate_filt.s = SYNTONIZE_S;
+    syn->error_filt.n = 0;
+    syn->error_filt.s = SYNTONIZE_ERROR_S;
+    syn->rate = (s64_t)ptpClock->observedDrift << ADJ_FREQ_SCALE;
+    syn->error = 0;
+    syn->samples = 0;
+    syn->valid = false;
+    syn->locked = false;
+}
+
 /* Initialise servo and clear network queue */
 void initClock(ptpClock_t *ptpClock)
 {
+    s32_t drift;
+    u32_t saved;
+    s64_t age;
+    timeInternal_t now;
+
     DBG("initClock\n");
 
+    /* (Re)select the clock servo and clear its state */
+    ptpClock->servoOps = servoSelect(ptpClock->servo.type);
+    ptpClock->servoOps->init(ptpClock);
+    ptpClock->lockedDriftValid = false;
+
+    /* Start from the frequency stored at the last run, if still believable */
+    if (restoreDrift(&drift, &saved)) {
+        getTime(&now);
+        age = (s64_t)(u32_t)now.seconds - saved;
+
+        if (drift > DRIFT_RESTORE_MAX || drift < -DRIFT_RESTORE_MAX) {
+            DBG("initClock: stored drift %d ppb out of bounds\n", drift);
+        }
+        else if (age < 0 || age > DRIFT_MAX_AGE) {
+            DBG("initClock: stored drift is stale (age %d s)\n", (s32_t)age);
+        }
+        else {
+            DBG("initClock: restored drift %d ppb\n", drift);
+            ptpClock->lockedDrift = drift;
+            ptpClock->lockedDriftValid = true;
+        }
+    }
+
+    resetClock(ptpClock);
+}
+
+/* Reset phase and path state, keep the frequency knowledge */
+void resetClock(ptpClock_t *ptpClock)
+{
+    DBG("resetClock\n");
+
     /* Clear vars */
     ptpClock->Tms.seconds = ptpClock->Tms.nanoseconds = 0;
-    ptpClock->observedDrift = 0;  /* clears clock servo accumulator (the I term) */
 
     /* One way delay */
     ptpClock->owd_filt.n = 0;
     ptpClock->owd_filt.s = ptpClock->servo.sDelay;
+    minWindowInit(&ptpClock->owd_sel, ptpClock->servo.delayWindow);
+
+    /* Peer delay */
+    ptpClock->pdelay_filt.n = 0;
+    ptpClock->pdelay_filt.s = ptpClock->servo.sDelay;
+    minWindowInit(&ptpClock->pdelay_sel, ptpClock->servo.delayWindow);
 
     /* Offset from master */
     ptpClock->ofm_filt.n = 0;
     ptpClock->ofm_filt.s = ptpClock->servo.sOffset;
+    outlierInit(&ptpClock->ofm_gate);
 
-    /* Scaled log variance */
-    if (DEFAULT_PARENTS_STATS) {
-        ptpClock->slv_filt.n = 0;
-        ptpClock->slv_filt.s = 6;
-        ptpClock->offsetHistory[0] = 0;
-        ptpClock->offsetHistory[1] = 0;
-    }
+    /* Stability statistics restart with the new phase */
+    stabilityInit(&ptpClock->stability);
 
     ptpClock->waitingForFollowUp = false;
+    ptpClock->syncReceipt.valid = false;
 
     ptpClock->waitingForPDelayRespFollowUp = false;
 
@@ -63,9 +337,26 @@ void initClock(ptpClock_t *ptpClock)
     ptpClock->parentDS.observedParentClockPhaseChangeRate = 0;
     ptpClock->parentDS.observedParentOffsetScaledLogVariance = 0;
 
-    /* Level clock */
+    /* Continue from the best frequency known: the holdover average, the last
+     * locked frequency, or none at all (measure it again) */
+    if (ptpClock->holdover.active)
+        ptpClock->observedDrift = holdoverDrift(ptpClock, holdoverDuration(ptpClock));
+    else if (ptpClock->lockedDriftValid)
+        ptpClock->observedDrift = ptpClock->lockedDrift;
+    else
+        ptpClock->observedDrift = 0;
+
+    ptpClock->servoOps->reset(ptpClock);
+    syntonizeReset(ptpClock);
+    standbyReset(ptpClock);
+
+    if (ptpClock->holdover.active || ptpClock->lockedDriftValid)
+        ptpClock->acquire.count = ptpClock->servo.acquireSamples;
+    else
+        ptpClock->acquire.count = 0;
+
     if (!ptpClock->servo.noAdjust)
-        adjFreq(0);
+        setFreq(ptpClock, (s64_t)ptpClock->observedDrift << ADJ_FREQ_SCALE);
 
     netEmptyEventQ(&ptpClock->netPath);
 }
@@ -83,9 +374,9 @@ static s32_t order(s32_t n)
 }
 
 /* Exponential smoothing */
-static void filter(s32_t *nsec_current, filter_t *filt)
+static void filter(s64_t *nsec_current, filter_t *filt)
 {
-    s32_t s, s2;
+    s32_t s;
 
     /*
         using floatingpoint math
@@ -98,6 +389,9 @@ static void filter(s32_t *nsec_current, filter_t *filt)
         y_sum[1] = y[1] * 2^s
         y_sum[n] = y_sum[n-1] + x[n-1] - y[n-1]
         y[n] = y_sum[n] / 2^s
+
+        y_sum is 64 bit, so the full order applies over the whole
+        +-FILTER_MAX_NS input range
     */
 
     /* Increment number of samples */
@@ -110,7 +404,7 @@ static void filter(s32_t *nsec_current, filter_t *filt)
         filt->s_prev = 0;
     }
 
-    s = filt->s;
+    s = min(max(filt->s, 0), FILTER_MAX_S);
 
     /* Speedup filter, if not 2^s > n */
     if ((1<<s) > filt->n) {
@@ -122,12 +416,6 @@ static void filter(s32_t *nsec_current, filter_t *filt)
         filt->n = 1<<s;
     }
 
-    /* Avoid overflowing of filter. 30 is because using signed 32bit integers */
-    s2 = 30 - order(max(filt->y_prev, *nsec_current));
-
-    /* Use the lower filter order, higher will overflow */
-    s = min(s, s2);
-
     /* If the order of the filter changed, change also y_sum value */
     if (filt->s_prev > s) {
         filt->y_sum >>= (filt->s_prev - s);
@@ -142,66 +430,372 @@ static void filter(s32_t *nsec_current, filter_t *filt)
     /* Save previous order of the filter */
     filt->s_prev = s;
 
-    DBGV("filter: %d -> %d (%d)\n", *nsec_current, filt->y_prev, s);
+    DBGV("filter: %d -> %d (%d)\n", (s32_t)*nsec_current, (s32_t)filt->y_prev, s);
 
     /* Actualize target value */
     *nsec_current = filt->y_prev;
 }
 
+/* Filter a time value, returns false if it is outside the filter range */
+static bool filterTime(timeInternal_t *value, filter_t *filt)
+{
+    s64_t nsec = internalTimeToNanoseconds(value);
+
+    if (nsec > FILTER_MAX_NS || nsec < -FILTER_MAX_NS)
+        return false;
+
+    filter(&nsec, filt);
+    nanosecondsToInternalTime(nsec, value);
+
+    return true;
+}
+
+/* Packet selection and filtering of a path delay, returns false if it is
+ * outside the filter range */
+static bool filterDelay(timeInternal_t *value, minWindow_t *win, filter_t *filt)
+{
+    s64_t nsec = internalTimeToNanoseconds(value);
+    s32_t selected;
+
+    if (nsec > FILTER_MAX_NS || nsec < -FILTER_MAX_NS)
+        return false;
+
+    selected = (s32_t)nsec;
+    minWindow(&selected, win);
+
+    nsec = selected;
+    filter(&nsec, filt);
+    nanosecondsToInternalTime(nsec, value);
+
+    return true;
+}
+
+/* Drift to apply after 'elapsed' seconds of holdover (ppb) */
+static s32_t holdoverDrift(const ptpClock_t *ptpClock, u32_t elapsed)
+{
+    const holdover_t *ho = &ptpClock->holdover;
+    s64_t drift = ho->drift;
+
+    if (ptpClock->servo.holdoverAging)
+        drift += ho->aging * elapsed / 86400;
+
+    drift >>= HOLDOVER_FRAC;
+    if (drift > ADJ_FREQ_MAX)
+        return ADJ_FREQ_MAX;
+    if (drift < -ADJ_FREQ_MAX)
+        return -ADJ_FREQ_MAX;
+    return (s32_t)drift;
+}
+
+/* Average the frequency while locked, and its trend for the aging model */
+static void holdoverTrack(ptpClock_t *ptpClock)
+{
+    holdover_t *ho = &ptpClock->holdover;
+    s64_t drift = (s64_t)ptpClock->observedDrift << HOLDOVER_FRAC;
+    s64_t dev;
+    s32_t now = ptpClock->timestamp_syncRecieve.seconds;
+
+    if (ho->samples == 0) {
+        ho->drift_filt.n = 0;
+        ho->drift_filt.s = HOLDOVER_DRIFT_S;
+        ho->wander_filt.n = 0;
+        ho->wander_filt.s = HOLDOVER_DRIFT_S;
+        ho->aging = 0;
+    }
+
+    filter(&drift, &ho->drift_filt);
+    ho->drift = drift;
+
+    dev = llabs(((s64_t)ptpClock->observedDrift << HOLDOVER_FRAC) - ho->drift);
+    filter(&dev, &ho->wander_filt);
+    ho->wander = dev;
+
+    if (ho->samples < UINT32_MAX)
+        ho->samples++;
+
+    if (ho->samples == HOLDOVER_MIN_SAMPLES) {
+        ho->checkpointDrift = ho->drift;
+        ho->checkpointTime = now;
+        ho->saveTime = now - DRIFT_SAVE_INTERVAL;
+    }
+    else if (ho->samples > HOLDOVER_MIN_SAMPLES && now - ho->checkpointTime >= HOLDOVER_AGING_PERIOD) {
+        ho->aging = (ho->drift - ho->checkpointDrift) * 86400 / (now - ho->checkpointTime);
+        ho->checkpointDrift = ho->drift;
+        ho->checkpointTime = now;
+        DBG("holdoverTrack: drift %d ppb, aging %d ppb/day\n",
+            (s32_t)(ho->drift >> HOLDOVER_FRAC), (s32_t)(ho->aging >> HOLDOVER_FRAC));
+    }
+
+    /* keep the long term average for the next boot */
+    if (ho->samples >= HOLDOVER_MIN_SAMPLES && now - ho->saveTime >= DRIFT_SAVE_INTERVAL) {
+        saveDrift(holdoverDrift(ptpClock, 0), (u32_t)now);
+        ho->saveTime = now;
+    }
+}
+
+/* 7.6.2.4 Table 5 - clockClass of a clock in holdover */
+static u8_t holdoverClockClass(u8_t clockClass, bool inSpec)
+{
+    switch (clockClass) {
+        case 6:
+            return inSpec ? 7 : 52; /* degradation alternative A */
+        case 13:
+            return inSpec ? 14 : 58; /* degradation alternative A */
+        default:
+            return clockClass; /* no holdover class defined */
+    }
+}
+
+/* Enter holdover if a long term drift estimate exists, call before initClock */
+void holdoverStart(ptpClock_t *ptpClock)
+{
+    holdover_t *ho = &ptpClock->holdover;
+    timeInternal_t now;
+    s64_t offset;
+
+    if (ho->active || ho->samples < HOLDOVER_MIN_SAMPLES)
+        return;
+
+    getTime(&now);
+    offset = llabs(internalTimeToNanoseconds(&ptpClock->currentDS.offsetFromMaster));
+
+    ho->active = true;
+    ho->start = now.seconds;
+    ho->initialError = offset > UINT32_MAX ? UINT32_MAX : (u32_t)offset;
+
+    DBG("holdoverStart: drift %d ppb\n", holdoverDrift(ptpClock, 0));
+}
+
+/* Leave holdover and restore the configured clockClass */
+void holdoverStop(ptpClock_t *ptpClock)
+{
+    if (!ptpClock->holdover.active)
+        return;
+
+    DBG("holdoverStop: after %d s\n", holdoverDuration(ptpClock));
+
+    ptpClock->holdover.active = false;
+    ptpClock->defaultDS.clockQuality.clockClass = ptpClock->rtOpts->clockQuality.clockClass;
+}
+
+/* Apply aging and update clockClass while in holdover */
+void holdoverUpdate(ptpClock_t *ptpClock)
+{
+    s32_t drift;
+    u8_t clockClass;
+
+    if (!ptpClock->holdover.active)
+        return;
+
+    drift = holdoverDrift(ptpClock, holdoverDuration(ptpClock));
+    if (drift != ptpClock->observedDrift) {
+        ptpClock->observedDrift = drift;
+        if (!ptpClock->servo.noAdjust)
+            setFreq(ptpClock, (s64_t)drift << ADJ_FREQ_SCALE);
+    }
+
+    clockClass = holdoverClockClass(ptpClock->rtOpts->clockQuality.clockClass,
+                                    holdoverError(ptpClock) <= HOLDOVER_SPEC_NS);
+    if (clockClass != ptpClock->defaultDS.clockQuality.clockClass) {
+        DBG("holdoverUpdate: clockClass %d\n", clockClass);
+        ptpClock->defaultDS.clockQuality.clockClass = clockClass;
+        if (ptpClock->portDS.portState == PTP_MASTER)
+            m1(ptpClock);
+    }
+}
+
+/* Seconds spent in holdover */
+u32_t holdoverDuration(const ptpClock_t *ptpClock)
+{
+    timeInternal_t now;
+
+    if (!ptpClock->holdover.active)
+        return 0;
+
+    getTime(&now);
+    return now.seconds > ptpClock->holdover.start ? (u32_t)(now.seconds - ptpClock->holdover.start) : 0;
+}
+
+/* Estimated time error in holdover (ns): the offset we left with, plus the
+ * frequency wander integrated over time, plus the aging if not modelled */
+u32_t holdoverError(const ptpClock_t *ptpClock)
+{
+    const holdover_t *ho = &ptpClock->holdover;
+    s64_t t = holdoverDuration(ptpClock);
+    s64_t err;
+
+    if (!ho->active)
+        return 0;
+
+    err = ho->initialError + ((ho->wander * t) >> HOLDOVER_FRAC);
+    if (!ptpClock->servo.holdoverAging)
+        err += ((llabs(ho->aging) >> HOLDOVER_FRAC) * t / 86400) * t / 2;
+
+    return err > UINT32_MAX ? UINT32_MAX : (u32_t)err;
+}
+
+/* Learn the frequency against temperature while locked */
+static void tempTrack(ptpClock_t *ptpClock)
+{
+    tempComp_t *tc = &ptpClock->tempComp;
+    s64_t temp, freq, var, cov, coeff, limit;
+
+    if (!tc->reading)
+        return;
+
+    if (tc->samples == 0) {
+        tc->temp_filt.n = 0;
+        tc->temp_filt.s = TEMP_COMP_S;
+        tc->freq_filt.n = 0;
+        tc->freq_filt.s = TEMP_COMP_S;
+        tc->var_filt.n = 0;
+        tc->var_filt.s = TEMP_COMP_S;
+        tc->cov_filt.n = 0;
+        tc->cov_filt.s = TEMP_COMP_S;
+    }
+
+    /* frequency of the oscillator itself, with the feed-forward put back */
+    temp = tc->temperature;
+    freq = ptpClock->observedDrift + (tc->applied >> ADJ_FREQ_SCALE);
+
+    var = tc->samples ? (temp - tc->temp) * (temp - tc->temp) : 0;
+    cov = tc->samples ? (temp - tc->temp) * (freq - tc->freq) : 0;
+
+    filter(&temp, &tc->temp_filt);
+    tc->temp = temp;
+    filter(&freq, &tc->freq_filt);
+    tc->freq = freq;
+    filter(&var, &tc->var_filt);
+    tc->var = var;
+    filter(&cov, &tc->cov_filt);
+    tc->cov = cov;
+
+    if (tc->samples < UINT32_MAX)
+        tc->samples++;
+
+    /* the slope is only well defined once the temperature has moved */
+    if (tc->samples < (1 << TEMP_COMP_S) || tc->var < (s64_t)TEMP_COMP_MIN_DEV * TEMP_COMP_MIN_DEV)
+        return;
+
+    coeff = (tc->cov << ADJ_FREQ_SCALE) / tc->var;
+    limit = ((s64_t)TEMP_COMP_COEFF_MAX << ADJ_FREQ_SCALE) / 1000;
+    if (coeff > limit)
+        coeff = limit;
+    else if (coeff < -limit)
+        coeff = -limit;
+
+    /* start from zero feed-forward at the current temperature */
+    if (!tc->valid) {
+        tc->reference = tc->temperature;
+        tc->valid = true;
+        DBG("tempTrack: %d ppb/degC at %d mdegC\n", (s32_t)((coeff * 1000) >> ADJ_FREQ_SCALE), tc->reference);
+    }
+    tc->coeff = coeff;
+}
+
+/* Read the temperature and follow it with the feed-forward between syncs */
+void tempUpdate(ptpClock_t *ptpClock)
+{
+    tempComp_t *tc = &ptpClock->tempComp;
+    s32_t temperature;
+    s64_t ff;
+
+    if (!getTemperature(&temperature))
+        return;
+
+    tc->temperature = temperature;
+    tc->reading = true;
+
+    if (!tc->valid || ptpClock->servo.noAdjust)
+        return;
+
+    ff = tempFeedForward(ptpClock);
+    if (llabs(ff - tc->applied) >= TEMP_COMP_UPDATE) {
+        tc->applied = ff;
+        adjFreq(-(tc->base + ff));
+    }
+}
+
 /* 11.2 - actual offset correction calculation based ib timestamps */
-void updateOffset(ptpClock_t *ptpClock, const timeInternal_t *syncEventIngressTimestamp,
+bool updateOffset(ptpClock_t *ptpClock, const timeInternal_t *syncEventIngressTimestamp,
                                             const timeInternal_t *preciseOriginTimestamp,
                                             const timeInternal_t *correctionField)
 {
+    timeInternal_t Tms, offset;
+    s64_t nsec;
+
     DBGV("updateOffset\n");
 
     /*  <offsetFromMaster> = <syncEventIngressTimestamp> - <preciseOriginTimestamp>
             - <meanPathDelay>  -  correctionField  of  Sync  message
             -  correctionField  of  Follow_Up message. */
 
-    /* Compute offsetFromMaster */
-    subTime(&ptpClock->Tms, syncEventIngressTimestamp, preciseOriginTimestamp);
-    subTime(&ptpClock->Tms, &ptpClock->Tms, correctionField);
+    /* Compute offsetFromMaster, Tms is kept only once the sample is accepted */
+    subTime(&Tms, syncEventIngressTimestamp, preciseOriginTimestamp);
+    subTime(&Tms, &Tms, correctionField);
 
-    ptpClock->currentDS.offsetFromMaster = ptpClock->Tms;
+    offset = Tms;
 
     switch (ptpClock->portDS.delayMechanism) {
         case E2E:
-            subTime(&ptpClock->currentDS.offsetFromMaster, &ptpClock->currentDS.offsetFromMaster, &ptpClock->currentDS.meanPathDelay);
+            subTime(&offset, &offset, &ptpClock->currentDS.meanPathDelay);
             break;
 
         case P2P:
-            subTime(&ptpClock->currentDS.offsetFromMaster, &ptpClock->currentDS.offsetFromMaster, &ptpClock->portDS.peerMeanPathDelay);
+            subTime(&offset, &offset, &ptpClock->portDS.peerMeanPathDelay);
             break;
 
         default:
             break;
     }
 
-    if (ptpClock->currentDS.offsetFromMaster.seconds != 0) {
+    /* Without phase steering the offset only reports how far apart the
+     * clocks are, the rate is measured from Tms in updateClock */
+    if (ptpClock->servo.syntonizeOnly) {
+        ptpClock->Tms = Tms;
+        ptpClock->currentDS.offsetFromMaster = offset;
+        ptpClock->rawOffsetFromMaster = offset;
+        return true;
+    }
+
+    /* Drop timestamp glitches before they reach the servo, a catch-up
+     * moves the offset faster than the gate follows */
+    if (!ptpClock->slew.active && !outlierCheck(&ptpClock->ofm_gate, internalTimeToNanoseconds(&offset)))
+        return false;
+
+    /* Restart the filter once the gate accepted a step */
+    if (ptpClock->ofm_gate.count == 1)
+        ptpClock->ofm_filt.n = 0;
+
+    ptpClock->Tms = Tms;
+    ptpClock->currentDS.offsetFromMaster = offset;
+    ptpClock->rawOffsetFromMaster = offset;
+
+    /* Filter offsetFromMaster */
+    if (!filterTime(&ptpClock->currentDS.offsetFromMaster, &ptpClock->ofm_filt)) {
         if (ptpClock->portDS.portState == PTP_SLAVE) {
             setFlag(ptpClock->events, SYNCHRONIZATION_FAULT);
         }
 
-        DBGV("updateOffset: cannot filter seconds\n");
+        DBGV("updateOffset: offset beyond filter range\n");
 
-        return;
+        return true;
     }
 
-    /* Filter offsetFromMaster */
-    filter(&ptpClock->currentDS.offsetFromMaster.nanoseconds, &ptpClock->ofm_filt);
-
     /* Check results */
-    if (abs(ptpClock->currentDS.offsetFromMaster.nanoseconds) < DEFAULT_CALIBRATED_OFFSET_NS) {
+    nsec = llabs(internalTimeToNanoseconds(&ptpClock->currentDS.offsetFromMaster));
+    if (nsec < DEFAULT_CALIBRATED_OFFSET_NS) {
         if (ptpClock->portDS.portState == PTP_UNCALIBRATED) {
             setFlag(ptpClock->events, MASTER_CLOCK_SELECTED);
         }
     }
-    else if (abs(ptpClock->currentDS.offsetFromMaster.nanoseconds) > DEFAULT_UNCALIBRATED_OFFSET_NS) {
+    else if (nsec > DEFAULT_UNCALIBRATED_OFFSET_NS) {
         if (ptpClock->portDS.portState == PTP_SLAVE) {
             setFlag(ptpClock->events, SYNCHRONIZATION_FAULT);
         }
     }
+
+    return true;
 }
 
 /* 11.3 - internally update the network path delay (based on basic filtering) */
@@ -221,11 +815,8 @@ void updateDelay(ptpClock_t *ptpClock, const timeInternal_t *delayEventEgressTim
     div2Time(&ptpClock->currentDS.meanPathDelay);
 
     /* Filter delay */
-    if (0 != ptpClock->currentDS.meanPathDelay.seconds) {
-        DBGV("updateDelay: cannot filter with seconds");
-    }
-    else {
-        filter(&ptpClock->currentDS.meanPathDelay.nanoseconds, &ptpClock->owd_filt);
+    if (!filterDelay(&ptpClock->currentDS.meanPathDelay, &ptpClock->owd_sel, &ptpClock->owd_filt)) {
+        DBGV("updateDelay: delay beyond filter range");
     }
 }
 
@@ -245,83 +836,536 @@ void updatePeerDelay(ptpClock_t *ptpClock, const timeInternal_t *correctionField
         subTime(&ptpClock->portDS.peerMeanPathDelay, &ptpClock->pdelay_t4, &ptpClock->pdelay_t1);
     }
 
+    /* delayAsymmetry cancels between both directions (11.6.4, 11.6.5) */
     subTime(&ptpClock->portDS.peerMeanPathDelay, &ptpClock->portDS.peerMeanPathDelay, correctionField);
     div2Time(&ptpClock->portDS.peerMeanPathDelay);
 
     /* Filter delay */
-    if (ptpClock->portDS.peerMeanPathDelay.seconds != 0) {
-        DBGV("updatePeerDelay: cannot filter with seconds");
+    if (!filterDelay(&ptpClock->portDS.peerMeanPathDelay, &ptpClock->pdelay_sel, &ptpClock->pdelay_filt)) {
+        DBGV("updatePeerDelay: delay beyond filter range");
+    }
+}
+
+/* Learn delayAsymmetry from the true offset of the clock from its master (ns),
+ * measured against a reference at the last Sync. Returns false unless the
+ * offset is being steered to zero as a slave. */
+bool calibrateAsymmetry(ptpClock_t *ptpClock, s32_t offset)
+{
+    s64_t asymmetry;
+
+    if (ptpClock->portDS.portState != PTP_SLAVE || ptpClock->servo.syntonizeOnly)
+        return false;
+
+    /* the measured offset is the true one plus the asymmetry not corrected for */
+    asymmetry = internalTimeToNanoseconds(&ptpClock->portDS.delayAsymmetry)
+                + internalTimeToNanoseconds(&ptpClock->currentDS.offsetFromMaster) - offset;
+
+    if (asymmetry > FILTER_MAX_NS || asymmetry < -FILTER_MAX_NS)
+        return false;
+
+    ptpClock->asymmetry_filt.s = ASYMMETRY_CAL_S;
+    filter(&asymmetry, &ptpClock->asymmetry_filt);
+
+    nanosecondsToInternalTime(asymmetry, &ptpClock->portDS.delayAsymmetry);
+    ptpClock->rtOpts->delayAsymmetry = ptpClock->portDS.delayAsymmetry;
+
+    DBG("calibrateAsymmetry: delay asymmetry %d nsec\n", (s32_t)asymmetry);
+
+    return true;
+}
+
+/* Forget the standby master, the next Sync of the runner-up starts again */
+void standbyReset(ptpClock_t *ptpClock)
+{
+    standby_t *sb = &ptpClock->standby;
+
+    memset(&sb->portIdentity, 0, sizeof(sb->portIdentity));
+    sb->ofm_filt.n = 0;
+    sb->ofm_filt.s = ptpClock->servo.sOffset;
+    sb->owd_filt.n = 0;
+    sb->owd_filt.s = ptpClock->servo.sDelay;
+    minWindowInit(&sb->owd_sel, ptpClock->servo.delayWindow);
+    sb->delay.seconds = sb->delay.nanoseconds = 0;
+    sb->waitingForFollowUp = false;
+    sb->valid = false;
+    sb->samples = 0;
+    sb->delaySamples = 0;
+}
+
+/* The same offset as updateOffset() but against the runner-up. The local
+ * clock follows the parent, so this is how far apart the two masters are. */
+void standbySync(ptpClock_t *ptpClock, const msgHeader_t *header,
+                                            const timeInternal_t *syncEventIngressTimestamp,
+                                            const timeInternal_t *preciseOriginTimestamp,
+                                            const timeInternal_t *correctionField)
+{
+    standby_t *sb = &ptpClock->standby;
+    timeInternal_t offset;
+
+    /* A new runner-up */
+    if (!isSamePortIdentity(&sb->portIdentity, &header->sourcePortIdentity)) {
+        standbyReset(ptpClock);
+        sb->portIdentity = header->sourcePortIdentity;
+        DBG("standbySync: tracking a new standby master\n");
+    }
+
+    subTime(&sb->Tms, syncEventIngressTimestamp, preciseOriginTimestamp);
+    subTime(&sb->Tms, &sb->Tms, correctionField);
+    sb->valid = true;
+
+    offset = sb->Tms;
+
+    switch (ptpClock->portDS.delayMechanism) {
+        case E2E:
+            /* no offset before the first path delay */
+            if (sb->delaySamples == 0)
+                return;
+            subTime(&offset, &offset, &sb->delay);
+            break;
+
+        case P2P:
+            /* the peer delay is the same link whoever the master is */
+            subTime(&offset, &offset, &ptpClock->portDS.peerMeanPathDelay);
+            break;
+
+        default:
+            break;
+    }
+
+    if (!filterTime(&offset, &sb->ofm_filt)) {
+        DBGV("standbySync: offset beyond filter range\n");
+        sb->ofm_filt.n = 0;
+        sb->samples = 0;
         return;
     }
-    else {
-        filter(&ptpClock->portDS.peerMeanPathDelay.nanoseconds, &ptpClock->owd_filt);
+
+    sb->offset = offset;
+    sb->samples++;
+    sb->lastSync = sys_now();
+    sb->logSyncInterval = header->logMessageInterval;
+    if (sb->logSyncInterval < LOG_INTERVAL_MIN || sb->logSyncInterval > LOG_INTERVAL_MAX)
+        sb->logSyncInterval = ptpClock->portDS.logSyncInterval;
+
+    DBGV("standbySync: offset %d nsec\n", (s32_t)internalTimeToNanoseconds(&sb->offset));
+}
+
+/* The same path delay as updateDelay() but against the runner-up */
+void standbyDelay(ptpClock_t *ptpClock, const timeInternal_t *delayEventEgressTimestamp,
+                                            const timeInternal_t *recieveTimestamp,
+                                            const timeInternal_t *correctionField)
+{
+    standby_t *sb = &ptpClock->standby;
+    timeInternal_t Tsm, delay;
+
+    /* Tms valid ? */
+    if (!sb->valid) {
+        DBGV("standbyDelay: Tms is not valid\n");
+        return;
+    }
+
+    subTime(&Tsm, recieveTimestamp, delayEventEgressTimestamp);
+    subTime(&Tsm, &Tsm, correctionField);
+    addTime(&delay, &sb->Tms, &Tsm);
+    div2Time(&delay);
+
+    if (!filterDelay(&delay, &sb->owd_sel, &sb->owd_filt)) {
+        DBGV("standbyDelay: delay beyond filter range\n");
+        return;
+    }
+
+    sb->delay = delay;
+    sb->delaySamples++;
+}
+
+/* The mark of a sync-faulted master is cleared by a Sync the standby would
+ * take a sample from: a receive timestamp and an offset within the filter
+ * range. No path delay to it is measured, Tms stands for the offset */
+bool syncFaultSync(ptpClock_t *ptpClock, const msgHeader_t *header,
+                                            const timeInternal_t *syncEventIngressTimestamp,
+                                            const timeInternal_t *preciseOriginTimestamp,
+                                            const timeInternal_t *correctionField)
+{
+    timeInternal_t Tms;
+    s64_t nsec;
+
+    if (syncEventIngressTimestamp->seconds <= 0) {
+        DBGV("syncFaultSync: no receive timestamp\n");
+        return false;
+    }
+
+    subTime(&Tms, syncEventIngressTimestamp, preciseOriginTimestamp);
+    subTime(&Tms, &Tms, correctionField);
+    nsec = internalTimeToNanoseconds(&Tms);
+
+    if (nsec > FILTER_MAX_NS || nsec < -FILTER_MAX_NS) {
+        DBGV("syncFaultSync: offset beyond filter range\n");
+        return false;
     }
+
+    if (!foreignSyncFault(ptpClock, &header->sourcePortIdentity, false))
+        return false;
+
+    DBG("syncFaultSync: usable Syncs from a sync-faulted master again\n");
+    return true;
+}
+
+bool standbyReady(const ptpClock_t *ptpClock)
+{
+    const standby_t *sb = &ptpClock->standby;
+
+    if (sb->samples < STANDBY_MIN_SAMPLES)
+        return false;
+
+    if (ptpClock->portDS.delayMechanism == E2E && sb->delaySamples == 0)
+        return false;
+
+    if (sys_now() - sb->lastSync > (u32_t)STANDBY_TIMEOUT * pow2ms(sb->logSyncInterval))
+        return false;
+
+    return llabs(internalTimeToNanoseconds(&sb->offset)) < DEFAULT_CALIBRATED_OFFSET_NS;
+}
+
+/* The frequency and the servo carry on across the failover: only the path
+ * delay and the offset history belong to the old master */
+bool standbySwitch(ptpClock_t *ptpClock)
+{
+    standby_t *sb = &ptpClock->standby;
+
+    if (!isSamePortIdentity(&sb->portIdentity, &ptpClock->parentDS.parentPortIdentity) || !standbyReady(ptpClock))
+        return false;
+
+    DBG("standbySwitch: offset %d nsec, delay %d nsec\n",
+                (s32_t)internalTimeToNanoseconds(&sb->offset), (s32_t)internalTimeToNanoseconds(&sb->delay));
+
+    ptpClock->Tms = sb->Tms;
+    if (ptpClock->portDS.delayMechanism == E2E) {
+        ptpClock->currentDS.meanPathDelay = sb->delay;
+        ptpClock->owd_filt = sb->owd_filt;
+        ptpClock->owd_sel = sb->owd_sel;
+    }
+
+    /* Tms and the offset are valid, so the path delay goes on being
+     * measured. The gate restarts the offset filter at the next Sync and
+     * the servo sees the masters' difference as a small phase change. */
+    ptpClock->ofm_filt = sb->ofm_filt;
+    ptpClock->currentDS.offsetFromMaster = sb->offset;
+    outlierInit(&ptpClock->ofm_gate);
+    stabilityInit(&ptpClock->stability);
+
+    ptpClock->waitingForFollowUp = false;
+    ptpClock->syncReceipt.valid = false;
+
+    /* Reset parent statistics */
+    ptpClock->parentDS.parentStats = false;
+    ptpClock->parentDS.observedParentClockPhaseChangeRate = 0;
+    ptpClock->parentDS.observedParentOffsetScaledLogVariance = 0;
+
+    sb->switches++;
+    standbyReset(ptpClock);
+
+    return true;
+}
+
+/* Once locked, bounded slew mode never steps the clock again */
+static bool mayStep(const ptpClock_t *ptpClock)
+{
+    return !ptpClock->servo.noResetClock && !(ptpClock->servo.maxSlew && ptpClock->slew.locked);
+}
+
+/* Step the clock back by 'offset', through LWIP_PTP_ADJ_PHASE when it fits */
+static void stepClock(const timeInternal_t *offset)
+{
+    timeInternal_t timeTmp;
+    s64_t nsec = internalTimeToNanoseconds(offset);
+
+    if (nsec >= -INT32_MAX && nsec <= INT32_MAX && adjPhase((s32_t)-nsec))
+        return;
+
+    getTime(&timeTmp);
+    subTime(&timeTmp, &timeTmp, offset);
+    setTime(&timeTmp);
+}
+
+/*
+ * Initial frequency acquisition: fit a line through the first Tms samples
+ * (ingress - origin, so path delay updates do not disturb the slope), then
+ * preset the frequency, step the phase once and hand over to the servo.
+ * Returns true while samples are still being collected.
+ */
+static bool acquireFrequency(ptpClock_t *ptpClock)
+{
+    acquire_t *acq = &ptpClock->acquire;
+    s64_t x, sumX = 0, sumY = 0, meanX, meanY, dx, sxx = 0, sxy = 0, predicted;
+    s32_t slope;
+    timeInternal_t step;
+    int i;
+
+    if (acq->count >= ptpClock->servo.acquireSamples)
+        return false;
+
+    /* Let the clock run at its natural rate while sampling */
+    if (acq->count == 0 && !ptpClock->servo.noAdjust)
+        setFreq(ptpClock, 0);
+
+    x = (s64_t)ptpClock->timestamp_syncRecieve.seconds * 1000000 + ptpClock->timestamp_syncRecieve.nanoseconds / 1000;
+    acq->points[acq->count].x = x;
+    acq->points[acq->count].y = internalTimeToNanoseconds(&ptpClock->Tms);
+    acq->count++;
+
+    if (acq->count < ptpClock->servo.acquireSamples)
+        return true;
+
+    for (i = 0; i < acq->count; i++) {
+        sumX += acq->points[i].x;
+        sumY += acq->points[i].y;
+    }
+    meanX = sumX / acq->count;
+    meanY = sumY / acq->count;
+
+    for (i = 0; i < acq->count; i++) {
+        dx = acq->points[i].x - meanX;
+        sxx += dx * dx;
+        sxy += dx * (acq->points[i].y - meanY);
+    }
+
+    /* ns per us is 10^6 ppb */
+    predicted = mulDiv64(sxy, 1000000, sxx);
+    if (predicted > ADJ_FREQ_MAX)
+        slope = ADJ_FREQ_MAX;
+    else if (predicted < -ADJ_FREQ_MAX)
+        slope = -ADJ_FREQ_MAX;
+    else
+        slope = (s32_t)predicted;
+
+    /* Offset on the fitted line at the last sample */
+    predicted = meanY + mulDiv64(sxy, x - meanX, sxx);
+    nanosecondsToInternalTime(internalTimeToNanoseconds(&ptpClock->rawOffsetFromMaster)
+                    + predicted - acq->points[acq->count - 1].y, &step);
+
+    DBG("acquireFrequency: drift %d ppb, offset %d sec %d nsec\n", slope, step.seconds, step.nanoseconds);
+
+    ptpClock->observedDrift = slope;
+    ptpClock->servoOps->reset(ptpClock);
+
+    if (!ptpClock->servo.noAdjust) {
+        setFreq(ptpClock, (s64_t)slope << ADJ_FREQ_SCALE);
+
+        if (mayStep(ptpClock)) {
+            stepClock(&step);
+
+            /* history before the step no longer applies */
+            ptpClock->ofm_filt.n = 0;
+            outlierInit(&ptpClock->ofm_gate);
+        }
+    }
+
+    return true;
+}
+
+/*
+ * Syntonization only: measure the rate of the master between the last Sync
+ * and this one and average it into the frequency correction. The phase is
+ * left alone, so the clock is never stepped and the path delay drops out.
+ */
+static void syntonizeClock(ptpClock_t *ptpClock)
+{
+    syntonize_t *syn = &ptpClock->syntonize;
+    timeInternal_t master, interval;
+    s64_t elapsed, drift, rate, error;
+    bool valid = syn->valid;
+
+    /* master time of the Sync, ingress - Tms = origin + correction */
+    subTime(&master, &ptpClock->timestamp_syncRecieve, &ptpClock->Tms);
+
+    subTime(&interval, &master, &syn->master);
+    elapsed = internalTimeToNanoseconds(&interval);
+    subTime(&interval, &ptpClock->timestamp_syncRecieve, &syn->local);
+    drift = internalTimeToNanoseconds(&interval) - elapsed;
+
+    syn->master = master;
+    syn->local = ptpClock->timestamp_syncRecieve;
+    syn->valid = true;
+
+    if (!valid)
+        return;
+
+    /* the rate left over plus the correction in effect since the last Sync
+     * (none without adjusting), the feed-forward cancels out */
+    rate = elapsed > 0 ? mulDiv64(drift, (s64_t)1000000000 << ADJ_FREQ_SCALE, elapsed) : 0;
+    rate += ptpClock->tempComp.base;
+
+    if (elapsed <= 0 || rate > ADJ_FREQ_MAX_SCALED || rate < -ADJ_FREQ_MAX_SCALED) {
+        DBG("syntonizeClock: master time jumped, restarting from this Sync\n");
+        return;
+    }
+
+    if (syn->samples > 0) {
+        error = llabs(rate - syn->rate);
+        filter(&error, &syn->error_filt);
+        syn->error = error;
+    }
+
+    filter(&rate, &syn->rate_filt);
+    syn->rate = rate;
+    if (syn->samples < UINT32_MAX)
+        syn->samples++;
+
+    ptpClock->observedDrift = (s32_t)(syn->rate >> ADJ_FREQ_SCALE);
+    if (!ptpClock->servo.noAdjust)
+        setFreq(ptpClock, syn->rate);
+
+    /* Timestamp noise cancels between successive rates, so the average
+     * is about 2^SYNTONIZE_S times steadier than a single rate */
+    error = syn->error >> (SYNTONIZE_S + ADJ_FREQ_SCALE);
+    if (syn->samples >= SYNTONIZE_MIN_SAMPLES && error < SYNTONIZE_CALIBRATED_PPB) {
+        syn->locked = true;
+        if (ptpClock->portDS.portState == PTP_UNCALIBRATED) {
+            setFlag(ptpClock->events, MASTER_CLOCK_SELECTED);
+        }
+    }
+    else if (error > SYNTONIZE_UNCALIBRATED_PPB) {
+        syn->locked = false;
+        if (ptpClock->portDS.portState == PTP_SLAVE) {
+            setFlag(ptpClock->events, SYNCHRONIZATION_FAULT);
+        }
+    }
+
+    /* learn the frequency to restart from and hold over with */
+    if (ptpClock->portDS.portState == PTP_SLAVE && syn->locked) {
+        ptpClock->lockedDrift = ptpClock->observedDrift;
+        ptpClock->lockedDriftValid = true;
+        holdoverTrack(ptpClock);
+        tempTrack(ptpClock);
+    }
+
+    DBG("syntonizeClock: rate %d ppb, uncertainty %d ppb\n", ptpClock->observedDrift, (s32_t)error);
+}
+
+/*
+ * Bounded slew: once the servo has locked the clock is not stepped again. An
+ * offset the servo cannot remove within one sync interval at servo.maxSlew
+ * is slewed out at exactly that rate on top of the frequency estimate, which
+ * takes |offset| / maxSlew seconds, then the servo takes over again.
+ * Returns true while catching up.
+ */
+static bool catchUp(ptpClock_t *ptpClock, s64_t offset)
+{
+    slew_t *slew = &ptpClock->slew;
+    s32_t maxSlew = ptpClock->servo.maxSlew;
+    s8_t logSyncInterval = ptpClock->portDS.logSyncInterval;
+    s64_t limit, adj;
+
+    if (maxSlew == 0 || !slew->locked)
+        return false;
+
+    /* ppb over one sync interval in ns, the servo only takes nanoseconds */
+    limit = logSyncInterval >= 0 ? (s64_t)maxSlew << logSyncInterval : (s64_t)maxSlew >> -logSyncInterval;
+    if (limit > MAX_ADJ_OFFSET_NS)
+        limit = MAX_ADJ_OFFSET_NS;
+
+    if (llabs(offset) <= limit) {
+        if (slew->active) {
+            DBG("catchUp: done\n");
+            slew->active = false;
+            /* the history of the servo and the gate predates the catch-up */
+            ptpClock->servoOps->reset(ptpClock);
+            outlierInit(&ptpClock->ofm_gate);
+        }
+        return false;
+    }
+
+    if (!slew->active) {
+        DBG("catchUp: slewing out %d ms at %d ppb\n", (s32_t)(offset / 1000000), maxSlew);
+        slew->active = true;
+        slew->start = offset;
+    }
+    slew->remaining = offset;
+
+    adj = (s64_t)ptpClock->observedDrift + (offset > 0 ? maxSlew : -maxSlew);
+    if (!ptpClock->servo.noAdjust)
+        setFreq(ptpClock, adj << ADJ_FREQ_SCALE);
+
+    return true;
 }
 
 /* Update local clock based on timestamps */
 void updateClock(ptpClock_t *ptpClock)
 {
-    s32_t adj;
-    timeInternal_t timeTmp;
-    s32_t offsetNorm;
+    s64_t adj, drift, limit;
+    s32_t phase = 0;
 
     DBGV("updateClock\n");
 
-    if (ptpClock->currentDS.offsetFromMaster.seconds != 0 || abs(ptpClock->currentDS.offsetFromMaster.nanoseconds) > MAX_ADJ_OFFSET_NS) {
+    if (ptpClock->servo.syntonizeOnly) {
+        syntonizeClock(ptpClock);
+        return;
+    }
+
+    if (catchUp(ptpClock, internalTimeToNanoseconds(&ptpClock->currentDS.offsetFromMaster))) {
+        DBGV("updateClock: catching up\n");
+    }
+    else if (ptpClock->currentDS.offsetFromMaster.seconds != 0 || abs(ptpClock->currentDS.offsetFromMaster.nanoseconds) > MAX_ADJ_OFFSET_NS) {
         /* if secs, reset clock or set freq adjustment to max */
         if (!ptpClock->servo.noAdjust) {
-            if (!ptpClock->servo.noResetClock) {
-                getTime(&timeTmp);
-                subTime(&timeTmp, &timeTmp, &ptpClock->currentDS.offsetFromMaster);
-                setTime(&timeTmp);
-                initClock(ptpClock);
+            if (mayStep(ptpClock)) {
+                stepClock(&ptpClock->currentDS.offsetFromMaster);
+                resetClock(ptpClock);
             }
             else {
-                adj = ptpClock->currentDS.offsetFromMaster.nanoseconds > 0 ? ADJ_FREQ_MAX : -ADJ_FREQ_MAX;
-                adjFreq(-adj);
+                adj = ptpClock->currentDS.offsetFromMaster.nanoseconds > 0 ? ADJ_FREQ_MAX_SCALED : -ADJ_FREQ_MAX_SCALED;
+                setFreq(ptpClock, adj);
+                /* the servo did not command this rate, drop its phase history */
+                ptpClock->servoOps->reset(ptpClock);
             }
         }
     }
-    else {
-        /* the PI controller */
-
-        /* normalize offset to 1s sync interval -> response of the servo will
-            * be same for all sync interval values, but faster/slower
-            * (possible lost of precision/overflow but much more stable) */
-        offsetNorm = ptpClock->currentDS.offsetFromMaster.nanoseconds;
-        if (ptpClock->portDS.logSyncInterval > 0)
-            offsetNorm >>= ptpClock->portDS.logSyncInterval;
-        else if (ptpClock->portDS.logSyncInterval < 0)
-            offsetNorm <<= -ptpClock->portDS.logSyncInterval;
-
-        /* the accumulator for the I component */
-        ptpClock->observedDrift += offsetNorm / ptpClock->servo.ai;
-
-        /* clamp the accumulator to ADJ_FREQ_MAX for sanity */
-        if (ptpClock->observedDrift > ADJ_FREQ_MAX)
-            ptpClock->observedDrift = ADJ_FREQ_MAX;
-        else if (ptpClock->observedDrift < -ADJ_FREQ_MAX)
-            ptpClock->observedDrift = -ADJ_FREQ_MAX;
-
-        /* apply controller output as a clock tick rate adjustment */
+    else if (!acquireFrequency(ptpClock)) {
+        /* run the selected servo, letting it shift the phase directly if
+         * the driver can and steps are allowed */
+        adj = ptpClock->servoOps->sample(ptpClock, ptpClock->servoOps->rawOffset ?
+                    ptpClock->rawOffsetFromMaster.nanoseconds :
+                    ptpClock->currentDS.offsetFromMaster.nanoseconds,
+                    &ptpClock->timestamp_syncRecieve,
+                    PHASE_ADJUST && !ptpClock->servo.noAdjust && mayStep(ptpClock) ? &phase : NULL);
+
+        /* once locked, never faster than maxSlew from the frequency estimate */
+        if (ptpClock->servo.maxSlew && ptpClock->slew.locked) {
+            drift = (s64_t)ptpClock->observedDrift << ADJ_FREQ_SCALE;
+            limit = (s64_t)ptpClock->servo.maxSlew << ADJ_FREQ_SCALE;
+            if (adj > drift + limit)
+                adj = drift + limit;
+            else if (adj < drift - limit)
+                adj = drift - limit;
+        }
+
+        /* apply servo output as a clock tick rate adjustment */
         if (!ptpClock->servo.noAdjust) {
-            adj = offsetNorm / ptpClock->servo.ap + ptpClock->observedDrift;
-            adjFreq(-adj);
+            if (phase != 0)
+                adjPhase(-phase);
+            setFreq(ptpClock, adj);
         }
 
-        if (DEFAULT_PARENTS_STATS) {
-            s32_t a, scaledLogVariance;
-            ptpClock->parentDS.parentStats = true;
-            ptpClock->parentDS.observedParentClockPhaseChangeRate = 1100 * ptpClock->observedDrift;
+        /* learn the frequency to restart from and hold over with */
+        if (ptpClock->portDS.portState == PTP_SLAVE && ptpClock->servoOps->state(ptpClock) == SERVO_LOCKED) {
+            ptpClock->lockedDrift = ptpClock->observedDrift;
+            ptpClock->lockedDriftValid = true;
+            ptpClock->slew.locked = true;
+            holdoverTrack(ptpClock);
+            tempTrack(ptpClock);
+        }
 
-            a = (ptpClock->offsetHistory[1] - 2 * ptpClock->offsetHistory[0] + ptpClock->currentDS.offsetFromMaster.nanoseconds);
-            ptpClock->offsetHistory[1] = ptpClock->offsetHistory[0];
-            ptpClock->offsetHistory[0] = ptpClock->currentDS.offsetFromMaster.nanoseconds;
+        /* stability of the measured (unfiltered) offset */
+        stabilitySample(&ptpClock->stability, ptpClock->rawOffsetFromMaster.nanoseconds, ptpClock->portDS.logSyncInterval);
 
-            scaledLogVariance = order(a * a) << 8;
-            filter(&scaledLogVariance, &ptpClock->slv_filt);
-            ptpClock->parentDS.observedParentOffsetScaledLogVariance = 17000 + scaledLogVariance;
+        if (DEFAULT_PARENTS_STATS && ptpClock->stability.samples >= STABILITY_MIN_SAMPLES) {
+            ptpClock->parentDS.parentStats = true;
+            ptpClock->parentDS.observedParentClockPhaseChangeRate = 1100 * ptpClock->observedDrift;
+            ptpClock->parentDS.observedParentOffsetScaledLogVariance = stabilityScaledLogVariance(&ptpClock->stability);
             DBGV("updateClock: observed scalled log variance: 0x%x\n", ptpClock->parentDS.observedParentOffsetScaledLogVariance);
+
+            /* advertised if we become master: measured while locked to it */
+            if (ptpClock->portDS.portState == PTP_SLAVE && ptpClock->servoOps->state(ptpClock) == SERVO_LOCKED)
+                ptpClock->defaultDS.clockQuality.offsetScaledLogVariance = ptpClock->parentDS.observedParentOffsetScaledLogVariance;
         }
     }
 
@@ -343,7 +1387,8 @@ void updateClock(ptpClock_t *ptpClock)
     DBG("updateClock: offset from master: %d sec %d nsec\n",
     ptpClock->currentDS.offsetFromMaster.seconds,
     ptpClock->currentDS.offsetFromMaster.nanoseconds);
-    DBG("updateClock: observed drift: %d\n", ptpClock->observedDrift);
+    DBG("updateClock: observed drift: %d (servo %d, state %d)\n", ptpClock->observedDrift,
+    ptpClock->servoOps->type, ptpClock->servoOps->state(ptpClock));
 }
 
 #endif /* LWIP_PTP || defined __DOXYGEN__ */
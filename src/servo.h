@@ -12,11 +12,62 @@
 
 #include "def/datatypes_private.h"
 
+/**
+ * \brief Clock servo interface. Each algorithm keeps its private state in
+ * ptpClock->servoData and publishes its frequency estimate in
+ * ptpClock->observedDrift.
+ */
+typedef struct servoOps {
+    u8_t type;
+    /* Servo wants unfiltered offsets (it does its own filtering) */
+    bool rawOffset;
+    /* Clear all servo state, including the frequency estimate */
+    void (*init)(ptpClock_t *ptpClock);
+    /* Feed one filtered offset sample (ns) taken at localTime and return the
+     * frequency adjustment (scaled ppb) that removes it. If 'phase' is not NULL the
+     * clock can be shifted directly: the servo may store the part of the
+     * offset (ns) to remove that way and leave it out of the frequency */
+    s64_t (*sample)(ptpClock_t *ptpClock, s32_t offset,
+                                const timeInternal_t *localTime, s32_t *phase);
+    /* Forget the phase history (e.g. after the clock was stepped) and
+     * continue from the frequency in ptpClock->observedDrift */
+    void (*reset)(ptpClock_t *ptpClock);
+    /* Current lock state (SERVO_UNLOCKED, SERVO_LOCKED) */
+    u8_t (*state)(const ptpClock_t *ptpClock);
+} servoOps_t;
+
+/* PI controller (servo_pi.c) */
+extern const servoOps_t servoPi;
+
+#if LWIP_PTP_SERVO_LINREG
+/* Linear regression over an adaptive window (servo_linreg.c) */
+extern const servoOps_t servoLinreg;
+#endif
+
+#if LWIP_PTP_SERVO_KALMAN
+/* Two state (phase, frequency) Kalman filter (servo_kalman.c) */
+extern const servoOps_t servoKalman;
+#endif
+
+/* Return the servo implementing 'type', falls back to the PI servo */
+const servoOps_t *servoSelect(u8_t type);
+
+/* True if the servo 'type' is built in */
+bool servoAvailable(u8_t type);
+
+/* Switch to the servo 'type', continuing from the frequency learned */
+void servoChange(ptpClock_t *ptpClock, u8_t type);
+
 /* Initialise servo and clear network queue */
 void initClock(ptpClock_t *ptpClock);
 
-/* 11.2 - actual offset correction calculation based ib timestamps */
-void updateOffset(ptpClock_t *ptpClock, const timeInternal_t *syncEventIngressTimestamp,
+/* Reset phase and path state but keep the learned frequency, used on state
+ * transitions and master changes */
+void resetClock(ptpClock_t *ptpClock);
+
+/* 11.2 - actual offset correction calculation based ib timestamps. Returns
+ * false if the offset was rejected as an outlier and must not be used. */
+bool updateOffset(ptpClock_t *ptpClock, const timeInternal_t *syncEventIngressTimestamp,
                                             const timeInternal_t *preciseOriginTimestamp,
                                             const timeInternal_t *correctionField);
 
@@ -32,4 +83,53 @@ void updatePeerDelay(ptpClock_t *ptpClock, const timeInternal_t *correctionField
 /* Update local clock based on timestamps */
 void updateClock(ptpClock_t *ptpClock);
 
+/* Average a reference measurement of the offset from master (ns) into
+ * delayAsymmetry, false unless calibrating is possible (SLAVE state) */
+bool calibrateAsymmetry(ptpClock_t *ptpClock, s32_t offset);
+
+/* Enter holdover if a long term drift estimate exists, call before initClock */
+void holdoverStart(ptpClock_t *ptpClock);
+
+/* Leave holdover and restore the configured clockClass */
+void holdoverStop(ptpClock_t *ptpClock);
+
+/* Apply aging and update clockClass while in holdover */
+void holdoverUpdate(ptpClock_t *ptpClock);
+
+/* Seconds spent in holdover and the estimated time error (ns) */
+u32_t holdoverDuration(const ptpClock_t *ptpClock);
+u32_t holdoverError(const ptpClock_t *ptpClock);
+
+/* Read the temperature and apply its feed-forward, call every iteration */
+void tempUpdate(ptpClock_t *ptpClock);
+
+/* Forget the standby master */
+void standbyReset(ptpClock_t *ptpClock);
+
+/* Offset from a Sync of the standby master (the BMC runner-up) */
+void standbySync(ptpClock_t *ptpClock, const msgHeader_t *header,
+                                            const timeInternal_t *syncEventIngressTimestamp,
+                                            const timeInternal_t *preciseOriginTimestamp,
+                                            const timeInternal_t *correctionField);
+
+/* Path delay from a Delay_Resp of the standby master to our last Delay_Req */
+void standbyDelay(ptpClock_t *ptpClock, const timeInternal_t *delayEventEgressTimestamp,
+                                            const timeInternal_t *recieveTimestamp,
+                                            const timeInternal_t *correctionField);
+
+/* Sync of a sync-faulted master, clears its mark if it gives an offset.
+ * True if the mark was cleared */
+bool syncFaultSync(ptpClock_t *ptpClock, const msgHeader_t *header,
+                                            const timeInternal_t *syncEventIngressTimestamp,
+                                            const timeInternal_t *preciseOriginTimestamp,
+                                            const timeInternal_t *correctionField);
+
+/* True if the standby master has a recent offset within
+ * DEFAULT_CALIBRATED_OFFSET_NS and, with E2E, a path delay */
+bool standbyReady(const ptpClock_t *ptpClock);
+
+/* Take over the standby measurements when it became the parent, keeping
+ * the servo. Returns false if the new parent is not a ready standby. */
+bool standbySwitch(ptpClock_t *ptpClock);
+
 #endif /* __LWIP_PTP_SERVO_H__ */
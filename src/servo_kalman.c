@@ -0,0 +1,160 @@
+/**
+ * @file
+ * @brief servo_kalman.c
+ * clock servo estimating phase and frequency with a two state Kalman filter.
+ * Suited to networks with large packet delay variation: the measurement
+ * noise (servo.r) sets how much of each offset sample is trusted, the
+ * process noise (servo.qPhase, servo.qFreq) how fast the clock may wander.
+ * Each sample costs a fixed number of 64 bit multiply/divides.
+ *
+ * @author @htmlonly &copy; @endhtmlonly 2020 James Bennion-Pedley
+ *
+ * @date 1 Oct 2020
+ */
+
+#include "servo.h"
+
+#if (LWIP_PTP && LWIP_PTP_SERVO_KALMAN) || defined __DOXYGEN__
+
+#include <stdlib.h>
+
+#include "arith.h"
+
+#define KALMAN_ONE      ((s64_t)1 << KALMAN_FRAC)
+#define KALMAN_FREQ_MAX ((s64_t)ADJ_FREQ_MAX << KALMAN_FRAC)
+
+static void kalmanInit(ptpClock_t *ptpClock)
+{
+    servoKalman_t *kf = &ptpClock->servoData.kalman;
+
+    ptpClock->observedDrift = 0;
+
+    kf->phase = 0;
+    kf->freq = 0;
+    kf->p00 = 0;
+    kf->p01 = 0;
+    kf->p11 = KALMAN_FREQ_VAR_INIT << KALMAN_COV_FRAC;
+    kf->lastX = 0;
+    kf->lastAdj = 0;
+    kf->samples = 0;
+}
+
+/* Forget the phase, continue from observedDrift with the current variance */
+static void kalmanReset(ptpClock_t *ptpClock)
+{
+    servoKalman_t *kf = &ptpClock->servoData.kalman;
+
+    kf->freq = (s64_t)ptpClock->observedDrift << KALMAN_FRAC;
+    kf->lastAdj = (s64_t)ptpClock->observedDrift << ADJ_FREQ_SCALE;
+    kf->phase = 0;
+    kf->p00 = 0;
+    kf->p01 = 0;
+    kf->samples = 0;
+}
+
+static s64_t kalmanSample(ptpClock_t *ptpClock, s32_t offset,
+                                const timeInternal_t *localTime, s32_t *phase)
+{
+    servoKalman_t *kf = &ptpClock->servoData.kalman;
+    s64_t x, dt, r, s, innov, p01, interval, adj;
+
+    x = (s64_t)localTime->seconds * 1000000 + localTime->nanoseconds / 1000;
+    r = ((s64_t)ptpClock->servo.r * ptpClock->servo.r) << KALMAN_COV_FRAC;
+
+    if (kf->samples == 0) {
+        /* First sample after init/reset: take the phase as measured */
+        kf->phase = (s64_t)offset << KALMAN_FRAC;
+        kf->p00 = r;
+        kf->p01 = 0;
+    }
+    else {
+        dt = x - kf->lastX;
+        if (dt <= 0)
+            dt = 1;
+
+        /* Predict: phase advances by (frequency - our correction) * dt */
+        kf->phase += mulDiv64(kf->freq - (kf->lastAdj >> (ADJ_FREQ_SCALE - KALMAN_FRAC)), dt, 1000000);
+
+        p01 = kf->p01 + mulDiv64(kf->p11, dt, 1000000);
+        kf->p00 += mulDiv64(kf->p01 + p01, dt, 1000000)
+                + mulDiv64((s64_t)ptpClock->servo.qPhase << KALMAN_COV_FRAC, dt, 1000000);
+        kf->p01 = p01;
+        kf->p11 += mulDiv64((s64_t)ptpClock->servo.qFreq << KALMAN_COV_FRAC, dt, 1000000);
+
+        /* Update with the measured offset */
+        s = kf->p00 + r;
+        innov = ((s64_t)offset << KALMAN_FRAC) - kf->phase;
+
+        kf->phase += mulDiv64(kf->p00, innov, s);
+        kf->freq += mulDiv64(kf->p01, innov, s);
+
+        kf->p11 -= mulDiv64(kf->p01, kf->p01, s);
+        kf->p00 = mulDiv64(kf->p00, r, s);
+        kf->p01 = mulDiv64(kf->p01, r, s);
+
+        /* rounding must not make the covariance lose definiteness */
+        if (kf->p11 < 1)
+            kf->p11 = 1;
+        if (kf->p00 < 1)
+            kf->p00 = 1;
+    }
+
+    kf->lastX = x;
+    kf->samples++;
+
+    if (kf->freq > KALMAN_FREQ_MAX)
+        kf->freq = KALMAN_FREQ_MAX;
+    else if (kf->freq < -KALMAN_FREQ_MAX)
+        kf->freq = -KALMAN_FREQ_MAX;
+    ptpClock->observedDrift = (s32_t)(kf->freq / KALMAN_ONE);
+
+    /* Remove the estimated phase, at once or over the next sync interval */
+    if (phase) {
+        *phase = (s32_t)(kf->phase / KALMAN_ONE);
+        kf->phase -= (s64_t)*phase << KALMAN_FRAC;
+        adj = kf->freq;
+    }
+    else {
+        interval = (s64_t)pow2ms(ptpClock->portDS.logSyncInterval) * 1000;
+        if (interval <= 0)
+            interval = 1000;
+        adj = kf->freq + kf->phase * 1000000 / interval;
+    }
+    adj *= (s64_t)1 << (ADJ_FREQ_SCALE - KALMAN_FRAC);
+
+    if (adj > ADJ_FREQ_MAX_SCALED)
+        adj = ADJ_FREQ_MAX_SCALED;
+    else if (adj < -ADJ_FREQ_MAX_SCALED)
+        adj = -ADJ_FREQ_MAX_SCALED;
+
+    kf->lastAdj = ptpClock->servo.noAdjust ? 0 : adj;
+
+    DBGV("kalmanSample: phase %d freq %d\n", (s32_t)(kf->phase / KALMAN_ONE), ptpClock->observedDrift);
+
+    return adj;
+}
+
+static u8_t kalmanState(const ptpClock_t *ptpClock)
+{
+    const servoKalman_t *kf = &ptpClock->servoData.kalman;
+
+    if (kf->samples < 4)
+        return SERVO_UNLOCKED;
+
+    if (llabs(kf->phase / KALMAN_ONE) < DEFAULT_CALIBRATED_OFFSET_NS &&
+        kf->p00 < ((s64_t)DEFAULT_CALIBRATED_OFFSET_NS * DEFAULT_CALIBRATED_OFFSET_NS) << KALMAN_COV_FRAC)
+        return SERVO_LOCKED;
+
+    return SERVO_UNLOCKED;
+}
+
+const servoOps_t servoKalman = {
+    SERVO_KALMAN,
+    true,
+    kalmanInit,
+    kalmanSample,
+    kalmanReset,
+    kalmanState
+};
+
+#endif /* (LWIP_PTP && LWIP_PTP_SERVO_KALMAN) || defined __DOXYGEN__ */
@@ -0,0 +1,217 @@
+/**
+ * @file
+ * @brief servo_linreg.c
+ * clock servo fitting frequency and phase by linear regression over a
+ * sliding window of (local time, offset) samples. The window length is
+ * chosen adaptively as the one which best predicted the recent samples.
+ *
+ * @author @htmlonly &copy; @endhtmlonly 2020 James Bennion-Pedley
+ *
+ * @date 1 Oct 2020
+ */
+
+#include "servo.h"
+
+#if (LWIP_PTP && LWIP_PTP_SERVO_LINREG) || defined __DOXYGEN__
+
+#include <stdlib.h>
+
+#include "arith.h"
+
+/* Rebase the stored phase before the ppb * us accumulator can overflow */
+#define LINREG_PHASE_LIMIT  ((s64_t)1 << 60)
+
+/* Saturate a 64 bit value to s32_t */
+static s32_t clamp32(s64_t x)
+{
+    if (x > INT32_MAX)
+        return INT32_MAX;
+    if (x < -INT32_MAX)
+        return -INT32_MAX;
+    return (s32_t)x;
+}
+
+static void linregInit(ptpClock_t *ptpClock)
+{
+    servoLinreg_t *lr = &ptpClock->servoData.linreg;
+    int i;
+
+    ptpClock->observedDrift = 0;
+
+    lr->head = 0;
+    lr->count = 0;
+    lr->order = LINREG_MIN_ORDER;
+    lr->phase = 0;
+    lr->lastX = 0;
+    lr->lastAdj = 0;
+    for (i = 0; i <= LINREG_MAX_ORDER; i++) {
+        lr->err[i] = 0;
+    }
+}
+
+/* Forget the sample window, keep the frequency estimate */
+static void linregReset(ptpClock_t *ptpClock)
+{
+    s32_t drift = ptpClock->observedDrift;
+
+    linregInit(ptpClock);
+    ptpClock->observedDrift = drift;
+    ptpClock->servoData.linreg.lastAdj = (s64_t)drift << ADJ_FREQ_SCALE;
+}
+
+/*
+ * Least squares fit of the newest n points. Returns the slope in scaled ppb and the
+ * value of the fit at x. Sums are taken around the mean and dx is scaled down
+ * for long windows so that every product stays within 64 bits.
+ */
+static void regress(const servoLinreg_t *lr, int n, s64_t x, s64_t *slope,
+                                                            s64_t *predicted)
+{
+    s64_t sumX = 0, sumY = 0, meanX, meanY, sxx = 0, sxy = 0, dx, span;
+    int i, idx, shift = 0;
+
+    for (i = 0, idx = lr->head; i < n; i++) {
+        idx = (idx + LINREG_MAX_POINTS - 1) % LINREG_MAX_POINTS;
+        sumX += lr->points[idx].x;
+        sumY += lr->points[idx].y;
+    }
+    meanX = sumX / n;
+    meanY = sumY / n;
+
+    /* idx is now the oldest point of the window */
+    span = lr->points[(lr->head + LINREG_MAX_POINTS - 1) % LINREG_MAX_POINTS].x - lr->points[idx].x;
+    while ((span >> shift) >= ((s64_t)1 << 24)) {
+        shift++;
+    }
+
+    for (i = 0, idx = lr->head; i < n; i++) {
+        idx = (idx + LINREG_MAX_POINTS - 1) % LINREG_MAX_POINTS;
+        dx = (lr->points[idx].x - meanX) >> shift;
+        sxx += dx * dx;
+        sxy += dx * (lr->points[idx].y - meanY);
+    }
+
+    if (sxx == 0) {
+        *slope = 0;
+        *predicted = meanY;
+        return;
+    }
+
+    /* ns per us is 10^6 ppb */
+    *slope = mulDiv64(sxy, (s64_t)1000000 << ADJ_FREQ_SCALE, sxx) / ((s64_t)1 << shift);
+    *predicted = meanY + mulDiv64(sxy, (x - meanX) >> shift, sxx);
+}
+
+static s64_t linregSample(ptpClock_t *ptpClock, s32_t offset,
+                                const timeInternal_t *localTime, s32_t *phase)
+{
+    servoLinreg_t *lr = &ptpClock->servoData.linreg;
+    s64_t x, y, predicted, estimate, interval, adj, base, slope;
+    s32_t err;
+    int order, i;
+
+    x = (s64_t)localTime->seconds * 1000000 + localTime->nanoseconds / 1000;
+
+    /* Phase our own frequency corrections removed since the last sample */
+    if (lr->count) {
+        lr->phase += mulDiv64(lr->lastAdj, x - lr->lastX, (s64_t)1 << ADJ_FREQ_SCALE);
+    }
+    lr->lastX = x;
+
+    if (lr->phase > LINREG_PHASE_LIMIT || lr->phase < -LINREG_PHASE_LIMIT) {
+        base = lr->phase / 1000000;
+        lr->phase -= base * 1000000;
+        for (i = 0; i < LINREG_MAX_POINTS; i++) {
+            lr->points[i].y -= base;
+        }
+    }
+
+    /* Offset the free running clock would have had */
+    y = offset + lr->phase / 1000000;
+
+    /* Score each window length by how well it predicted this sample */
+    for (order = LINREG_MIN_ORDER; order <= LINREG_MAX_ORDER && (1 << order) <= lr->count; order++) {
+        regress(lr, 1 << order, x, &slope, &predicted);
+        err = clamp32(llabs(y - predicted));
+        if (lr->count == (1 << order))
+            lr->err[order] = err; /* first prediction of this window */
+        else
+            lr->err[order] += (err - lr->err[order]) >> LINREG_ERR_S;
+    }
+
+    lr->points[lr->head].x = x;
+    lr->points[lr->head].y = y;
+    lr->head = (lr->head + 1) % LINREG_MAX_POINTS;
+    if (lr->count < LINREG_MAX_POINTS)
+        lr->count++;
+
+    /* Select the window with the smallest prediction error */
+    lr->order = LINREG_MIN_ORDER;
+    for (order = LINREG_MIN_ORDER + 1; order <= LINREG_MAX_ORDER && (1 << order) < lr->count; order++) {
+        if (lr->err[order] < lr->err[lr->order])
+            lr->order = order;
+    }
+
+    if (lr->count < 2) {
+        slope = (s64_t)ptpClock->observedDrift << ADJ_FREQ_SCALE;
+        predicted = y;
+    }
+    else {
+        regress(lr, (1 << lr->order) <= lr->count ? (1 << lr->order) : lr->count, x, &slope, &predicted);
+    }
+
+    if (slope > ADJ_FREQ_MAX_SCALED)
+        slope = ADJ_FREQ_MAX_SCALED;
+    else if (slope < -ADJ_FREQ_MAX_SCALED)
+        slope = -ADJ_FREQ_MAX_SCALED;
+    ptpClock->observedDrift = (s32_t)(slope >> ADJ_FREQ_SCALE);
+
+    /* Remove the estimated offset, at once or over the next sync interval */
+    estimate = predicted - lr->phase / 1000000;
+    if (phase) {
+        *phase = clamp32(estimate);
+        lr->phase += (s64_t)*phase * 1000000;
+        adj = slope;
+    }
+    else {
+        interval = (s64_t)pow2ms(ptpClock->portDS.logSyncInterval) * 1000;
+        if (interval <= 0)
+            interval = 1000;
+        adj = slope + mulDiv64(estimate, (s64_t)1000000 << ADJ_FREQ_SCALE, interval);
+    }
+
+    if (adj > ADJ_FREQ_MAX_SCALED)
+        adj = ADJ_FREQ_MAX_SCALED;
+    else if (adj < -ADJ_FREQ_MAX_SCALED)
+        adj = -ADJ_FREQ_MAX_SCALED;
+
+    lr->lastAdj = ptpClock->servo.noAdjust ? 0 : adj;
+
+    DBGV("linregSample: window %d slope %d estimate %d\n", 1 << lr->order, ptpClock->observedDrift, (s32_t)estimate);
+
+    return adj;
+}
+
+static u8_t linregState(const ptpClock_t *ptpClock)
+{
+    const servoLinreg_t *lr = &ptpClock->servoData.linreg;
+
+    if (lr->count <= (1 << LINREG_MIN_ORDER))
+        return SERVO_UNLOCKED;
+
+    if (lr->err[lr->order] < DEFAULT_CALIBRATED_OFFSET_NS)
+        return SERVO_LOCKED;
+
+    return SERVO_UNLOCKED;
+}
+
+const servoOps_t servoLinreg = {
+    SERVO_LINREG,
+    true,
+    linregInit,
+    linregSample,
+    linregReset,
+    linregState
+};
+
+#endif /* (LWIP_PTP && LWIP_PTP_SERVO_LINREG) || defined __DOXYGEN__ */
@@ -0,0 +1,176 @@
+/**
+ * @file
+ * @brief servo_pi.c
+ * proportional-integral clock servo. The gains start at servo.ap/servo.ai
+ * and, once the port is calibrated, are tightened up to servo.gainSteps
+ * times while the offset is dominated by noise rather than by a trend.
+ *
+ * @author @htmlonly &copy; @endhtmlonly 2020 James Bennion-Pedley
+ *
+ * @date 1 Oct 2020
+ */
+
+#include "servo.h"
+
+#if LWIP_PTP || defined __DOXYGEN__
+
+#include <stdlib.h>
+
+/* Restart the gain schedule from the acquisition gains */
+static void piScheduleReset(ptpClock_t *ptpClock)
+{
+    servoPi_t *pi = &ptpClock->servoData.pi;
+
+    pi->mean = 0;
+    pi->var = 0;
+    pi->dwell = 0;
+    pi->step = 0;
+    pi->logSyncInterval = ptpClock->portDS.logSyncInterval;
+}
+
+/* Clear the servo accumulator (the I term) */
+static void piInit(ptpClock_t *ptpClock)
+{
+    ptpClock->observedDrift = 0;
+    ptpClock->servoData.pi.integral = 0;
+    ptpClock->servoData.pi.lastOffset = 0;
+    ptpClock->servoData.pi.samples = 0;
+    piScheduleReset(ptpClock);
+}
+
+/* Move the gain schedule to 'step' */
+static void piScheduleStep(servoPi_t *pi, int step)
+{
+    pi->step = step;
+    pi->dwell = 0;
+}
+
+/*
+ * Choose the gains for this sample. Each step doubles ap and quadruples ai,
+ * halving the loop bandwidth at the same damping. A loop that is slow enough
+ * to filter the timestamp noise leaves offsets that average out; one that
+ * is too slow to follow the oscillator wander leaves a persistent mean.
+ * Tighten while the smoothed mean is small against the rms offset, loosen
+ * when it is not, and go back to the acquisition gains when uncalibrated.
+ */
+static void piSchedule(ptpClock_t *ptpClock, s32_t offset)
+{
+    servoPi_t *pi = &ptpClock->servoData.pi;
+    s64_t sq = (s64_t)offset * offset;
+    s64_t mean;
+    int step;
+
+    if (pi->samples == 1) {
+        pi->mean = (s64_t)offset << GAIN_VAR_S;
+        pi->var = sq;
+    }
+    else {
+        pi->mean += offset - (pi->mean >> GAIN_VAR_S);
+        pi->var += (sq - pi->var) >> GAIN_VAR_S;
+    }
+    /* mean^2 is compared against var / GAIN_*, saturated it cannot overflow */
+    mean = pi->mean >> GAIN_VAR_S;
+    if (mean > INT32_MAX || mean < -INT32_MAX)
+        mean = INT32_MAX;
+    pi->dwell++;
+
+    /* Keep the bandwidth in Hz when the sync interval changes: twice the
+     * syncs per second need gains one step tighter */
+    if (pi->logSyncInterval != ptpClock->portDS.logSyncInterval) {
+        step = pi->step + pi->logSyncInterval - ptpClock->portDS.logSyncInterval;
+        pi->logSyncInterval = ptpClock->portDS.logSyncInterval;
+        if (step < 0)
+            step = 0;
+        else if (step > ptpClock->servo.gainSteps)
+            step = ptpClock->servo.gainSteps;
+        piScheduleStep(pi, step);
+    }
+
+    if (ptpClock->portDS.portState == PTP_UNCALIBRATED || abs(offset) >= DEFAULT_CALIBRATED_OFFSET_NS) {
+        piScheduleStep(pi, 0);
+    }
+    else if (pi->step > 0 && mean * mean > pi->var / GAIN_LOOSEN) {
+        piScheduleStep(pi, pi->step - 1);
+    }
+    else if (pi->step < ptpClock->servo.gainSteps && pi->dwell >= (1 << GAIN_VAR_S) && mean * mean < pi->var / GAIN_TIGHTEN) {
+        piScheduleStep(pi, pi->step + 1);
+    }
+}
+
+/* The PI controller, in scaled ppb so small offsets are not truncated away */
+static s64_t piSample(ptpClock_t *ptpClock, s32_t offset,
+                                const timeInternal_t *localTime, s32_t *phase)
+{
+    servoPi_t *pi = &ptpClock->servoData.pi;
+    s64_t offsetNorm;
+    s32_t ap, ai;
+
+    UNUSED(localTime);
+
+    pi->lastOffset = offset;
+    pi->samples++;
+
+    piSchedule(ptpClock, offset);
+    ap = (s32_t)ptpClock->servo.ap << pi->step;
+    ai = (s32_t)ptpClock->servo.ai << (2 * pi->step);
+
+    /* normalize offset to 1s sync interval -> response of the servo will
+        * be same for all sync interval values, but faster/slower
+        * (possible lost of precision/overflow but much more stable) */
+    offsetNorm = (s64_t)offset << ADJ_FREQ_SCALE;
+    if (ptpClock->portDS.logSyncInterval > 0)
+        offsetNorm >>= ptpClock->portDS.logSyncInterval;
+    else if (ptpClock->portDS.logSyncInterval < 0)
+        offsetNorm <<= -ptpClock->portDS.logSyncInterval;
+
+    /* the accumulator for the I component */
+    pi->integral += offsetNorm / ai;
+
+    /* clamp the accumulator to ADJ_FREQ_MAX for sanity */
+    if (pi->integral > ADJ_FREQ_MAX_SCALED)
+        pi->integral = ADJ_FREQ_MAX_SCALED;
+    else if (pi->integral < -ADJ_FREQ_MAX_SCALED)
+        pi->integral = -ADJ_FREQ_MAX_SCALED;
+
+    ptpClock->observedDrift = (s32_t)(pi->integral >> ADJ_FREQ_SCALE);
+
+    /* the P term as a phase shift, the same fraction of the offset per sample */
+    if (phase) {
+        *phase = offset / ap;
+        return pi->integral;
+    }
+
+    /* controller output as a clock tick rate adjustment */
+    return offsetNorm / ap + pi->integral;
+}
+
+/* The PI servo has no phase history beyond the last sample */
+static void piReset(ptpClock_t *ptpClock)
+{
+    ptpClock->servoData.pi.integral = (s64_t)ptpClock->observedDrift << ADJ_FREQ_SCALE;
+    ptpClock->servoData.pi.lastOffset = 0;
+    ptpClock->servoData.pi.samples = 0;
+    piScheduleReset(ptpClock);
+}
+
+static u8_t piState(const ptpClock_t *ptpClock)
+{
+    if (ptpClock->servoData.pi.samples == 0)
+        return SERVO_UNLOCKED;
+
+    if (abs(ptpClock->servoData.pi.lastOffset) < DEFAULT_CALIBRATED_OFFSET_NS)
+        return SERVO_LOCKED;
+
+    return SERVO_UNLOCKED;
+}
+
+const servoOps_t servoPi = {
+    SERVO_PI,
+    false,
+    piInit,
+    piSample,
+    piReset,
+    piState
+};
+
+#endif /* LWIP_PTP || defined __DOXYGEN__ */
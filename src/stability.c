@@ -0,0 +1,165 @@
+/**
+ * @file
+ * @brief stability.c
+ * online clock stability statistics of the offset from master. For every
+ * octave tau = 2^k sync intervals the Allan deviation (from offsets 2^k
+ * apart), the time deviation (from averages over 2^k offsets) and MTIE
+ * (peak to peak over consecutive rather than all windows of tau, a lower
+ * bound) are kept in fixed memory. Each offset costs two octaves on average.
+ *
+ * @author @htmlonly &copy; @endhtmlonly 2020 James Bennion-Pedley
+ *
+ * @date 1 Oct 2020
+ */
+
+#include "stability.h"
+
+#if LWIP_PTP || defined __DOXYGEN__
+
+#include "arith.h"
+
+/* Saturate a second difference so that its square fits in 63 bits */
+static s64_t square(s64_t d)
+{
+    if (d > INT32_MAX || d < -INT32_MAX)
+        d = INT32_MAX;
+    return d * d;
+}
+
+/* Running mean of the first 2^STABILITY_AVG_S values, then exponencial smoothing */
+static void average(s64_t *mean, s64_t value, u32_t n)
+{
+    if (n > (1 << STABILITY_AVG_S))
+        n = 1 << STABILITY_AVG_S;
+    *mean += (value - *mean) / (s64_t)n;
+}
+
+void stabilityInit(stability_t *stab)
+{
+    int k;
+
+    for (k = 0; k < STABILITY_OCTAVES; k++) {
+        stab->octave[k].pending = false;
+        stab->octave[k].history = 0;
+        stab->octave[k].avar = 0;
+        stab->octave[k].tvar = 0;
+        stab->octave[k].mtie = 0;
+        stab->octave[k].n = 0;
+    }
+    stab->samples = 0;
+}
+
+/* A complete block of 2^k offsets: first offset, average and extremes */
+static void stabilityBlock(stability_t *stab, int k, s32_t dec, s32_t avg,
+                                                        s32_t max, s32_t min)
+{
+    stabilityOctave_t *oct;
+    s64_t hi, lo;
+
+    for (; k < STABILITY_OCTAVES; k++) {
+        oct = &stab->octave[k];
+
+        /* The last block and the first offset of this one span tau */
+        if (oct->history > 0) {
+            hi = oct->max > dec ? oct->max : dec;
+            lo = oct->min < dec ? oct->min : dec;
+            if (hi - lo > oct->mtie)
+                oct->mtie = (hi - lo) > UINT32_MAX ? UINT32_MAX : (u32_t)(hi - lo);
+        }
+
+        if (oct->history > 1) {
+            oct->n++;
+            average(&oct->avar, square((s64_t)dec - 2 * (s64_t)oct->dec[1] + oct->dec[0]), oct->n);
+            average(&oct->tvar, square((s64_t)avg - 2 * (s64_t)oct->avg[1] + oct->avg[0]), oct->n);
+        }
+        else {
+            oct->history++;
+        }
+
+        oct->dec[0] = oct->dec[1];
+        oct->dec[1] = dec;
+        oct->avg[0] = oct->avg[1];
+        oct->avg[1] = avg;
+        oct->max = max;
+        oct->min = min;
+
+        /* Every second block completes one of the octave above */
+        if (!oct->pending) {
+            oct->pendDec = dec;
+            oct->pendAvg = avg;
+            oct->pendMax = max;
+            oct->pendMin = min;
+            oct->pending = true;
+            return;
+        }
+
+        oct->pending = false;
+        dec = oct->pendDec;
+        avg = (s32_t)(((s64_t)oct->pendAvg + avg) / 2);
+        max = oct->pendMax > max ? oct->pendMax : max;
+        min = oct->pendMin < min ? oct->pendMin : min;
+    }
+}
+
+void stabilitySample(stability_t *stab, s32_t offset, s8_t logInterval)
+{
+    if (stab->samples == 0 || stab->logInterval != logInterval) {
+        stabilityInit(stab);
+        stab->logInterval = logInterval;
+    }
+
+    stab->samples++;
+    stabilityBlock(stab, 0, offset, offset, offset, offset);
+}
+
+bool stabilityGet(const stability_t *stab, u8_t octave, u32_t *adev,
+                                                u32_t *tdev, u32_t *mtie)
+{
+    const stabilityOctave_t *oct;
+    s32_t logTau;
+    u64_t dev;
+
+    if (octave >= STABILITY_OCTAVES || stab->octave[octave].n == 0)
+        return false;
+
+    oct = &stab->octave[octave];
+    logTau = octave + stab->logInterval;
+
+    if (adev) {
+        /* sqrt(avar / 2) ns over tau s, in 10^-12 */
+        if (oct->avar < ((s64_t)1 << 43))
+            dev = sqrt64((u64_t)oct->avar * 500000);
+        else
+            dev = (u64_t)sqrt64((u64_t)oct->avar / 2) * 1000;
+        if (logTau >= 0)
+            dev >>= logTau;
+        else
+            dev = (-logTau >= 32 || dev > (UINT32_MAX >> -logTau)) ? UINT32_MAX : dev << -logTau;
+        *adev = dev > UINT32_MAX ? UINT32_MAX : (u32_t)dev;
+    }
+    if (tdev)
+        *tdev = sqrt64((u64_t)oct->tvar / 6);
+    if (mtie)
+        *mtie = oct->mtie;
+
+    return true;
+}
+
+s16_t stabilityScaledLogVariance(const stability_t *stab)
+{
+    s32_t value;
+
+    if (stab->samples < STABILITY_MIN_SAMPLES || stab->octave[0].n == 0)
+        return 0x7FFF;
+
+    /* TVAR at tau0 in ns^2, log2 in units of 2^-8 of the variance in s^2
+     * (1 ns^2 = 2^-59.79 s^2) plus 0x8000 */
+    value = scaledLog2((u64_t)stab->octave[0].tvar / 6);
+    if (value < 0)
+        value = 0;
+    value += 0x8000 - 15307;
+
+    return value > 0x7FFF ? 0x7FFF : (s16_t)value;
+}
+
+#endif /* LWIP_PTP || defined __DOXYGEN__ */
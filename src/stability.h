@@ -0,0 +1,41 @@
+#ifndef __LWIP_PTP_STABILITY_H__
+#define __LWIP_PTP_STABILITY_H__
+
+/**
+ * @file
+ * @brief ptpd-lwip clock stability statistics
+ *
+ * @author @htmlonly &copy; @endhtmlonly 2020 James Bennion-Pedley
+ *
+ * @date 1 Oct 2020
+ */
+
+#include "def/datatypes_private.h"
+
+/**
+ * \brief Clear all estimates
+ */
+void stabilityInit(stability_t *stab);
+
+/**
+ * \brief Feed one offset from master (ns) taken 2^logInterval seconds after
+ * the previous one. A change of the interval restarts the estimates.
+ */
+void stabilitySample(stability_t *stab, s32_t offset, s8_t logInterval);
+
+/**
+ * \brief Get the estimates for tau = 2^(octave + logInterval) seconds: Allan
+ * deviation in units of 10^-12, time deviation and MTIE in nanoseconds.
+ * \return false if the octave has no estimate yet
+ */
+bool stabilityGet(const stability_t *stab, u8_t octave, u32_t *adev,
+                                                u32_t *tdev, u32_t *mtie);
+
+/**
+ * \brief PTP variance (7.6.3.3) at tau = one sync interval, as the
+ * offsetScaledLogVariance representation of 7.6.3.5
+ * \return 0x7FFF if there are fewer than STABILITY_MIN_SAMPLES offsets
+ */
+s16_t stabilityScaledLogVariance(const stability_t *stab);
+
+#endif /* __LWIP_PTP_STABILITY_H__ */
@@ -28,20 +28,89 @@ void setTime(const timeInternal_t *time)
     DBG("resetting system clock to %d sec %d nsec\n", time->seconds, time->nanoseconds);
 }
 
-/* modify the PTP system time by fine adjustment (using an accumulator) */
-bool adjFreq(s32_t adj)
+/* modify the PTP system time by fine adjustment (using an accumulator),
+ * adj is in scaled ppb (ADJ_FREQ_SCALE fractional bits) */
+bool adjFreq(s64_t adj)
 {
-    DBGV("adjFreq %d\n", adj);
+#if !defined LWIP_PTP_UPDATE_FINE_SCALED
+    /* fraction of a ppb not applied yet */
+    static s64_t residue = 0;
+    s32_t ppb;
+#endif
 
-    if (adj > ADJ_FREQ_MAX)
-        adj = ADJ_FREQ_MAX;
-    else if (adj < -ADJ_FREQ_MAX)
-        adj = -ADJ_FREQ_MAX;
+    DBGV("adjFreq %d\n", (s32_t)(adj >> ADJ_FREQ_SCALE));
+
+    if (adj > ADJ_FREQ_MAX_SCALED)
+        adj = ADJ_FREQ_MAX_SCALED;
+    else if (adj < -ADJ_FREQ_MAX_SCALED)
+        adj = -ADJ_FREQ_MAX_SCALED;
 
     /* Fine update method */
-    LWIP_PTP_UPDATE_FINE(adj);
+#if defined LWIP_PTP_UPDATE_FINE_SCALED
+    LWIP_PTP_UPDATE_FINE_SCALED(adj);
+#else
+    /* The driver takes whole ppb: round, and carry the remainder over to the
+     * next update so the rate averages out to the requested one */
+    adj += residue;
+    ppb = (s32_t)((adj + ((s64_t)1 << (ADJ_FREQ_SCALE - 1))) >> ADJ_FREQ_SCALE);
+    if (ppb > ADJ_FREQ_MAX)
+        ppb = ADJ_FREQ_MAX;
+    else if (ppb < -ADJ_FREQ_MAX)
+        ppb = -ADJ_FREQ_MAX;
+    residue = adj - ((s64_t)ppb << ADJ_FREQ_SCALE);
+
+    LWIP_PTP_UPDATE_FINE(ppb);
+#endif
+
+    return true;
+}
 
+/* shift the PTP system time by adj ns, false if LWIP_PTP_ADJ_PHASE is not configured */
+bool adjPhase(s32_t adj)
+{
+#if defined LWIP_PTP_ADJ_PHASE
+    DBGV("adjPhase %d\n", adj);
+    LWIP_PTP_ADJ_PHASE(adj);
     return true;
+#else
+    UNUSED(adj);
+    return false;
+#endif
+}
+
+/* store the learned frequency, if LWIP_PTP_SAVE_DRIFT is configured */
+void saveDrift(s32_t drift, u32_t seconds)
+{
+#if defined LWIP_PTP_SAVE_DRIFT
+    DBGV("saveDrift %d\n", drift);
+    LWIP_PTP_SAVE_DRIFT(drift, seconds);
+#else
+    UNUSED(drift);
+    UNUSED(seconds);
+#endif
+}
+
+/* read back the stored frequency, false if there is none */
+bool restoreDrift(s32_t *drift, u32_t *seconds)
+{
+#if defined LWIP_PTP_RESTORE_DRIFT
+    return LWIP_PTP_RESTORE_DRIFT(drift, seconds);
+#else
+    UNUSED(drift);
+    UNUSED(seconds);
+    return false;
+#endif
+}
+
+/* read the oscillator temperature (m degC), false if there is none */
+bool getTemperature(s32_t *temperature)
+{
+#if defined LWIP_PTP_GET_TEMPERATURE
+    return LWIP_PTP_GET_TEMPERATURE(temperature);
+#else
+    UNUSED(temperature);
+    return false;
+#endif
 }
 
 /* Generate random integer up to specified maximum */
@@ -27,8 +27,21 @@ void setTime(const timeInternal_t *time);
 /* modify the PTP system time by adding the value in timestamp */
 void updateTime(const timeInternal_t *time);
 
-/* modify the PTP system time by fine adjustment (using an accumulator) */
-bool adjFreq(s32_t adj);
+/* modify the PTP system time by fine adjustment (using an accumulator),
+ * adj is in scaled ppb (ADJ_FREQ_SCALE fractional bits) */
+bool adjFreq(s64_t adj);
+
+/* shift the PTP system time by adj ns, false if LWIP_PTP_ADJ_PHASE is not configured */
+bool adjPhase(s32_t adj);
+
+/* store the learned frequency, if LWIP_PTP_SAVE_DRIFT is configured */
+void saveDrift(s32_t drift, u32_t seconds);
+
+/* read back the stored frequency, false if there is none */
+bool restoreDrift(s32_t *drift, u32_t *seconds);
+
+/* read the oscillator temperature (m degC), false if there is none */
+bool getTemperature(s32_t *temperature);
 
 /* Generate random integer up to specified maximum */
 u32_t getRand(u32_t randMax);
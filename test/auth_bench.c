@@ -0,0 +1,179 @@
+/**
+ * @file
+ * @brief auth_bench.c
+ * host benchmark of the AUTHENTICATION TLV: cost of signing and verifying
+ * one message with a precomputed HMAC-SHA256 key, per message type and ICV
+ * length. A master verifies one Delay_Req per slave and delay request
+ * interval, which is what the cost has to be budgeted against. Also checks
+ * that tampered and malformed messages are rejected, and that a key-ID in
+ * use is replaced through the queue of the PTP thread.
+ *
+ *   auth_bench [iterations]
+ */
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "auth.h"
+#include "host.h"
+
+static const char key[] = "lwip-ptp host benchmark key 0123";
+
+static int failures;
+
+static void expect(bool cond, const char *what)
+{
+    if (!cond) {
+        printf("FAIL: %s\n", what);
+        failures++;
+    }
+}
+
+/* A packed message of 'length' octets with the header fields authVerify reads */
+static s16_t packMessage(octet_t *buf, u8_t type, s16_t length)
+{
+    int i;
+
+    for (i = 0; i < length; i++)
+        buf[i] = (octet_t)(i * 7);
+    buf[0] = type;
+    buf[1] = 2;
+    *(s16_t*)(buf + 2) = flip16(length);
+    return length;
+}
+
+static void header(msgHeader_t *h, const octet_t *buf)
+{
+    memset(h, 0, sizeof(*h));
+    h->messageType = buf[0] & 0x0F;
+    h->messageLength = flip16(*(s16_t*)(buf + 2));
+}
+
+static void bench(const char *name, u8_t type, s16_t baseLength, u8_t icvLength, long iterations)
+{
+    static authDS_t auth;
+    octet_t buf[PACKET_SIZE];
+    msgHeader_t h;
+    s16_t length = baseLength;
+    u64_t t0, signNs, verifyNs;
+    long i, ok = 0;
+
+    memset(&auth, 0, sizeof(auth));
+    authSetKey(&auth, 1, (const u8_t *)key, sizeof(key) - 1, icvLength);
+    authSetTxKey(&auth, 1);
+
+    t0 = hostNanos();
+    for (i = 0; i < iterations; i++) {
+        packMessage(buf, type, baseLength);
+        length = authAppendTlv(&auth, buf, baseLength);
+    }
+    signNs = hostNanos() - t0;
+
+    header(&h, buf);
+    t0 = hostNanos();
+    for (i = 0; i < iterations; i++)
+        ok += authVerify(&auth, buf, length, &h);
+    verifyNs = hostNanos() - t0;
+
+    expect(ok == iterations, "valid message verifies");
+
+    printf("%-10s %3d + %2d octets  icv %2d:  sign %6.0f ns  verify %6.0f ns  (%.0f verified/s)\n",
+        name, baseLength, length - baseLength, icvLength,
+        (double)signNs / iterations, (double)verifyNs / iterations,
+        1e9 * iterations / (double)verifyNs);
+}
+
+/* Tampered, truncated and malformed messages must be dropped */
+static void rejects(void)
+{
+    static authDS_t auth;
+    octet_t buf[PACKET_SIZE];
+    msgHeader_t h;
+    s16_t length;
+
+    memset(&auth, 0, sizeof(auth));
+    authSetKey(&auth, 1, (const u8_t *)key, sizeof(key) - 1, 16);
+    authSetTxKey(&auth, 1);
+
+    packMessage(buf, ANNOUNCE, ANNOUNCE_LENGTH);
+    length = authAppendTlv(&auth, buf, ANNOUNCE_LENGTH);
+    header(&h, buf);
+    expect(authVerify(&auth, buf, length, &h), "signed Announce verifies");
+
+    buf[40] ^= 1;
+    expect(!authVerify(&auth, buf, length, &h), "tampered Announce is rejected");
+    buf[40] ^= 1;
+
+    expect(!authVerify(&auth, buf, length - 1, &h), "truncated Announce is rejected");
+
+    /* An unsigned message with a TLV claiming 0x7FFF octets */
+    packMessage(buf, ANNOUNCE, ANNOUNCE_LENGTH + TLV_HEADER_LENGTH + 10);
+    *(u16_t*)(buf + ANNOUNCE_LENGTH) = flip16(0x0003);
+    *(u16_t*)(buf + ANNOUNCE_LENGTH + 2) = flip16(0x7FFF);
+    header(&h, buf);
+    expect(!authVerify(&auth, buf, ANNOUNCE_LENGTH + TLV_HEADER_LENGTH + 10, &h), "oversized TLV is rejected");
+
+    /* messageLength beyond what was received */
+    packMessage(buf, ANNOUNCE, ANNOUNCE_LENGTH);
+    length = authAppendTlv(&auth, buf, ANNOUNCE_LENGTH);
+    header(&h, buf);
+    h.messageLength = 0x7FFF;
+    expect(!authVerify(&auth, buf, length, &h), "messageLength beyond the packet is rejected");
+}
+
+/* Annex P key rotation: the new key of a key-ID in use is queued and
+ * installed at once, the signing key follows it */
+static void rotate(void)
+{
+    static const char newKey[] = "lwip-ptp host benchmark key 4567";
+    static authDS_t auth;
+    authKey_t entry;
+    octet_t buf[PACKET_SIZE];
+    msgHeader_t h;
+    s16_t length;
+    u32_t id;
+
+    memset(&auth, 0, sizeof(auth));
+    authSetKey(&auth, 1, (const u8_t *)key, sizeof(key) - 1, 16);
+    authSetTxKey(&auth, 1);
+
+    packMessage(buf, SYNC, SYNC_LENGTH);
+    length = authAppendTlv(&auth, buf, SYNC_LENGTH);
+    header(&h, buf);
+
+    expect(authMakeKey(&entry, 1, (const u8_t *)newKey, sizeof(newKey) - 1, 8) == ERR_ARG, "short ICV is refused");
+    authMakeKey(&entry, 1, (const u8_t *)newKey, sizeof(newKey) - 1, 16);
+    expect(authQueueKey(&auth, &entry) == ERR_OK, "key queued");
+    expect(authVerify(&auth, buf, length, &h), "old key in use until installed");
+
+    expect(authInstallQueued(&auth) == 0, "queued key installed");
+    expect(!authVerify(&auth, buf, length, &h), "old key gone after rotation");
+
+    packMessage(buf, SYNC, SYNC_LENGTH);
+    length = authAppendTlv(&auth, buf, SYNC_LENGTH);
+    expect(authVerify(&auth, buf, length, &h), "signing key follows the rotation");
+
+    for (id = 10; id < 10 + LWIP_PTP_AUTH_MAX_KEYS; id++) {
+        entry.keyId = id;
+        authQueueKey(&auth, &entry);
+    }
+    entry.keyId = id;
+    expect(authQueueKey(&auth, &entry) == ERR_MEM, "full queue is refused");
+    expect(authInstallQueued(&auth) == 1, "key beyond the table dropped");
+}
+
+int main(int argc, char **argv)
+{
+    long iterations = argc > 1 ? atol(argv[1]) : 100000;
+
+    rejects();
+    rotate();
+
+    bench("Sync", SYNC, SYNC_LENGTH, 16, iterations);
+    bench("Sync", SYNC, SYNC_LENGTH, 32, iterations);
+    bench("Delay_Req", DELAY_REQ, DELAY_REQ_LENGTH, 16, iterations);
+    bench("Announce", ANNOUNCE, ANNOUNCE_LENGTH, 16, iterations);
+    bench("Announce", ANNOUNCE, ANNOUNCE_LENGTH, 32, iterations);
+
+    return failures ? EXIT_FAILURE : EXIT_SUCCESS;
+}
@@ -0,0 +1,445 @@
+/**
+ * @file
+ * @brief bmc_bench.c
+ * host benchmark of the foreign master data set: cost of addForeign() and
+ * of the bmc() run that follows each Announce, with every master announcing
+ * once per announce interval. Also runs more masters than the table holds
+ * and checks that the best one still qualifies and the parent is kept, and
+ * that a parent marked sync-faulted stays out until a Sync of it gives an
+ * offset again. A randomized run then checks the best and the runner-up the
+ * incremental BMC keeps against a full scan of the table after every bmc()
+ * call, through priority changes, silent masters aging out, sync faults and
+ * evictions from a full table. The scan ranks by figure 27 field by field,
+ * as bmc.c did before the packed keys, and every key has to order the
+ * records the same way; an unknown variance of 0xFFFF has to lose.
+ *
+ *   bmc_bench [rounds] [events]
+ */
+
+#include <stdlib.h>
+#include <string.h>
+
+#include <lwip/sys.h>
+
+#include "bmc.h"
+#include "host.h"
+#include "servo.h"
+
+#define ANNOUNCE_LOG_INTERVAL   1
+
+/* Randomized run: masters announcing into a smaller table */
+#define RANDOM_MASTERS          48
+#define RANDOM_RECORDS          16
+
+static int failures;
+
+static void expect(bool cond, const char *what)
+{
+    if (!cond) {
+        printf("FAIL: %s\n", what);
+        failures++;
+    }
+}
+
+/* Clock identity of master 'id', a lower id is a better grandmaster */
+static void identity(octet_t *clockIdentity, u16_t id)
+{
+    static const octet_t base[CLOCK_IDENTITY_LENGTH] = { 0x00, 0x1B, 0x19, 0xFF, 0xFE, 0x00, 0x00, 0x00 };
+
+    memcpy(clockIdentity, base, CLOCK_IDENTITY_LENGTH);
+    clockIdentity[6] = (octet_t)(id >> 8);
+    clockIdentity[7] = (octet_t)id;
+}
+
+/* Announce of grandmaster 'id', the same dataset for all but the identity */
+static void message(msgHeader_t *header, msgAnnounce_t *msg, u16_t id, u16_t sequenceId)
+{
+    memset(header, 0, sizeof(*header));
+    memset(msg, 0, sizeof(*msg));
+    identity(header->sourcePortIdentity.clockIdentity, id);
+    header->sourcePortIdentity.portNumber = 1;
+    header->sequenceId = sequenceId;
+    header->logMessageInterval = ANNOUNCE_LOG_INTERVAL;
+    identity(msg->grandmasterIdentity, id);
+    msg->grandmasterPriority1 = 100;
+    msg->grandmasterClockQuality.clockClass = 6;
+    msg->grandmasterClockQuality.clockAccuracy = 0x21;
+    msg->grandmasterClockQuality.offsetScaledLogVariance = 0x4E5D;
+    msg->grandmasterPriority2 = 128;
+}
+
+/* Announce of grandmaster 'id' through addForeign(), then a BMC run as
+ * handleAnnounce() does, adding the time each took */
+static void announce(ptpClock_t *ptpClock, u16_t id, u16_t sequenceId, u64_t *addNs, u64_t *bmcNs)
+{
+    msgHeader_t header;
+    msgAnnounce_t msg;
+    u64_t t0, t1;
+
+    message(&header, &msg, id, sequenceId);
+
+    t0 = hostNanos();
+    addForeign(ptpClock, &header, &msg);
+    t1 = hostNanos();
+    ptpClock->portDS.portState = bmc(ptpClock);
+    *addNs += t1 - t0;
+    *bmcNs += hostNanos() - t1;
+}
+
+/* 'rounds' announce intervals of 'masters' grandmasters, master 0 goes last
+ * so it has to find room in a full table */
+static long rounds(ptpClock_t *ptpClock, u16_t masters, long first, long count, u64_t *addNs, u64_t *bmcNs)
+{
+    long r;
+    u16_t m;
+
+    for (r = first; r < first + count; r++) {
+        for (m = 0; m < masters; m++) {
+            hostClockAdvance(pow2ms(ANNOUNCE_LOG_INTERVAL) * 1000000LL / masters);
+            announce(ptpClock, (u16_t)(masters - 1 - m), (u16_t)r, addNs, bmcNs);
+        }
+    }
+
+    return count * masters;
+}
+
+/* Whether the port is slave to master 'id' */
+static bool slaveTo(const ptpClock_t *ptpClock, u16_t id)
+{
+    octet_t clockIdentity[CLOCK_IDENTITY_LENGTH];
+
+    identity(clockIdentity, id);
+    return ptpClock->foreignMasterDS.best >= 0 && ptpClock->portDS.portState == PTP_SLAVE &&
+            memcmp(ptpClock->parentDS.parentPortIdentity.clockIdentity, clockIdentity, CLOCK_IDENTITY_LENGTH) == 0;
+}
+
+/* 'masters' grandmasters announcing into a table of 'records', master 0 is
+ * the best. Returns whether the port ends up slave to it */
+static bool run(u16_t masters, u16_t records, long count)
+{
+    static ptpClock_t ptpClock;
+    static runTimeOpts_t rtOpts;
+    foreignMasterDS_t *ds = &ptpClock.foreignMasterDS;
+    u64_t addNs = 0, bmcNs = 0;
+    long calls;
+    bool slave;
+
+    hostPtpInit(&ptpClock, &rtOpts, records);
+    ptpClock.portDS.portState = PTP_LISTENING;
+
+    calls = rounds(&ptpClock, masters, 0, count, &addNs, &bmcNs);
+
+    printf("%5d masters %5d records:  addForeign %5.0f ns  bmc %6.0f ns  rescans %6lu  decisions %6lu\n",
+            masters, records, (double)addNs / calls, (double)bmcNs / calls,
+            (unsigned long)ds->rescans, (unsigned long)ds->decisions);
+
+    slave = slaveTo(&ptpClock, 0);
+
+    free(ds->records);
+    free(ds->buckets);
+    return slave;
+}
+
+/* The parent's Syncs stop while it still announces, as syncReceiptTimeout()
+ * handles it: the port moves to the runner-up and stays there, even with a
+ * full table, until a Sync of the parent gives an offset again. Syncs with
+ * a lost receive timestamp or an offset out of range do not count */
+static void syncFault(void)
+{
+    static ptpClock_t ptpClock;
+    static runTimeOpts_t rtOpts;
+    foreignMasterDS_t *ds = &ptpClock.foreignMasterDS;
+    portIdentity_t parent;
+    msgHeader_t header;
+    timeInternal_t ingress = { 1000, 250000 }, lost = { 0, 0 }, far = { 1003, 0 };
+    timeInternal_t origin = { 1000, 0 }, correction = { 0, 0 };
+    u64_t addNs = 0, bmcNs = 0;
+
+    hostPtpInit(&ptpClock, &rtOpts, 5);
+    ptpClock.portDS.portState = PTP_LISTENING;
+
+    rounds(&ptpClock, 8, 0, 4, &addNs, &bmcNs);
+    expect(slaveTo(&ptpClock, 0), "sync fault: slave to the best");
+
+    parent = ptpClock.parentDS.parentPortIdentity;
+    expect(foreignSyncFault(&ptpClock, &parent, true), "sync fault: parent marked");
+    ptpClock.portDS.portState = bmc(&ptpClock);
+    expect(slaveTo(&ptpClock, 1), "sync fault: slave to the runner-up");
+
+    rounds(&ptpClock, 8, 4, 8, &addNs, &bmcNs);
+    expect(slaveTo(&ptpClock, 1), "sync fault: still slave to the runner-up");
+
+    memset(&header, 0, sizeof(header));
+    header.sourcePortIdentity = parent;
+    expect(!syncFaultSync(&ptpClock, &header, &lost, &origin, &correction), "sync fault: lost timestamp ignored");
+    expect(!syncFaultSync(&ptpClock, &header, &far, &origin, &correction), "sync fault: offset out of range ignored");
+    expect(foreignSyncFaulted(&ptpClock, &parent), "sync fault: still marked");
+    ptpClock.portDS.portState = bmc(&ptpClock);
+    expect(slaveTo(&ptpClock, 1), "sync fault: unusable Syncs keep the runner-up");
+
+    expect(syncFaultSync(&ptpClock, &header, &ingress, &origin, &correction), "sync fault: mark cleared");
+    ptpClock.portDS.portState = bmc(&ptpClock);
+    expect(slaveTo(&ptpClock, 0), "sync fault: back to the best");
+    expect(ds->syncFaults == 0, "sync fault: none left");
+
+    free(ds->records);
+    free(ds->buckets);
+}
+
+/* offsetScaledLogVariance is a UInteger16 (5.3.7): 0xFFFF, unknown, loses
+ * to 0x4E5D even from the better identity */
+static void variance(void)
+{
+    static ptpClock_t ptpClock;
+    static runTimeOpts_t rtOpts;
+    foreignMasterDS_t *ds = &ptpClock.foreignMasterDS;
+    msgHeader_t header;
+    msgAnnounce_t msg;
+    u16_t r, id;
+
+    hostPtpInit(&ptpClock, &rtOpts, 4);
+    ptpClock.portDS.portState = PTP_LISTENING;
+
+    for (r = 0; r < DEFAULT_FOREIGN_MASTER_THRESHOLD; r++) {
+        for (id = 0; id < 2; id++) {
+            hostClockAdvance(pow2ms(ANNOUNCE_LOG_INTERVAL) * 1000000LL / 2);
+            message(&header, &msg, id, r);
+            if (id == 0)
+                msg.grandmasterClockQuality.offsetScaledLogVariance = (s16_t)0xFFFF;
+            addForeign(&ptpClock, &header, &msg);
+            ptpClock.portDS.portState = bmc(&ptpClock);
+        }
+    }
+
+    expect(slaveTo(&ptpClock, 1), "variance: 0x4E5D before the unknown 0xFFFF");
+
+    free(ds->records);
+    free(ds->buckets);
+}
+
+/* A grandmaster of the randomized run, its own source */
+typedef struct {
+    msgAnnounce_t announce;
+    s8_t logInterval;
+    u16_t sequenceId;
+    u32_t silentUntil; /**< sys_now() it announces again after */
+} master_t;
+
+/* Figure 27 field by field, the reference for the packed keys, with
+ * offsetScaledLogVariance the UInteger16 of 5.3.7. Like memcmp(), negative
+ * when 'a' is the better grandmaster */
+static int referenceComparison(const msgAnnounce_t *a, const msgAnnounce_t *b)
+{
+    if (a->grandmasterPriority1 != b->grandmasterPriority1)
+        return a->grandmasterPriority1 < b->grandmasterPriority1 ? -1 : 1;
+    if (a->grandmasterClockQuality.clockClass != b->grandmasterClockQuality.clockClass)
+        return a->grandmasterClockQuality.clockClass < b->grandmasterClockQuality.clockClass ? -1 : 1;
+    if (a->grandmasterClockQuality.clockAccuracy != b->grandmasterClockQuality.clockAccuracy)
+        return a->grandmasterClockQuality.clockAccuracy < b->grandmasterClockQuality.clockAccuracy ? -1 : 1;
+    if (a->grandmasterClockQuality.offsetScaledLogVariance != b->grandmasterClockQuality.offsetScaledLogVariance)
+        return (u16_t)a->grandmasterClockQuality.offsetScaledLogVariance <
+                (u16_t)b->grandmasterClockQuality.offsetScaledLogVariance ? -1 : 1;
+    if (a->grandmasterPriority2 != b->grandmasterPriority2)
+        return a->grandmasterPriority2 < b->grandmasterPriority2 ? -1 : 1;
+
+    return memcmp(a->grandmasterIdentity, b->grandmasterIdentity, CLOCK_IDENTITY_LENGTH);
+}
+
+/* Whether the packed keys of two records order them as the reference does */
+static bool keyAgrees(const foreignMasterRecord_t *a, const foreignMasterRecord_t *b)
+{
+    int ref = referenceComparison(&a->announce, &b->announce);
+    int key = a->key[0] != b->key[0] ? (a->key[0] < b->key[0] ? -1 : 1) :
+              a->key[1] != b->key[1] ? (a->key[1] < b->key[1] ? -1 : 1) : 0;
+
+    return (ref < 0) == (key < 0) && (ref > 0) == (key > 0);
+}
+
+/* Whether 'a' ranks before 'b'. Every master is its own grandmaster, so
+ * figure 27 alone orders them */
+static bool ranksBefore(const foreignMasterRecord_t *a, const foreignMasterRecord_t *b)
+{
+    return referenceComparison(&a->announce, &b->announce) < 0;
+}
+
+/* 9.3.2.5 qualification, as the full scan sees it */
+static bool qualified(const foreignMasterRecord_t *rec, u32_t now)
+{
+    return !rec->syncFault && rec->foreignMasterAnnounceMessages >= DEFAULT_FOREIGN_MASTER_THRESHOLD &&
+            now - rec->received[0] <= DEFAULT_FOREIGN_MASTER_TIME_WINDOW * (u32_t)pow2ms(rec->header.logMessageInterval);
+}
+
+/* Whether a port identity has a record */
+static bool known(const foreignMasterDS_t *ds, const portIdentity_t *portIdentity)
+{
+    s16_t i;
+
+    for (i = ds->newest; i >= 0; i = ds->records[i].older) {
+        if (isSamePortIdentity(portIdentity, &ds->records[i].foreignMasterPortIdentity))
+            return true;
+    }
+
+    return false;
+}
+
+/* Best and runner-up by a scan of every record, -1 for none */
+static void scan(const ptpClock_t *ptpClock, s16_t *best, s16_t *second)
+{
+    const foreignMasterDS_t *ds = &ptpClock->foreignMasterDS;
+    u32_t now = sys_now();
+    s16_t i;
+
+    *best = *second = -1;
+    for (i = ds->newest; i >= 0; i = ds->records[i].older) {
+        if (!qualified(&ds->records[i], now))
+            continue;
+        if (*best < 0 || ranksBefore(&ds->records[i], &ds->records[*best])) {
+            *second = *best;
+            *best = i;
+        }
+        else if (*second < 0 || ranksBefore(&ds->records[i], &ds->records[*second])) {
+            *second = i;
+        }
+    }
+}
+
+/* Random dataset of a grandmaster, sometimes sharing fields with the others
+ * so the later ones of figure 27 decide */
+static void randomDataset(msgAnnounce_t *announce)
+{
+    announce->grandmasterPriority1 = (u8_t)(hostRand() % 2 ? 128 : hostRand() % 256);
+    announce->grandmasterClockQuality.clockClass = (u8_t)(hostRand() % 2 ? 248 : hostRand() % 256);
+    announce->grandmasterClockQuality.clockAccuracy = (u8_t)(hostRand() % 2 ? 0xFE : 0x20 + hostRand() % 0x12);
+    announce->grandmasterClockQuality.offsetScaledLogVariance = (s16_t)(hostRand() % 2 ? 0xFFFF : hostRand() % 0x10000);
+    announce->grandmasterPriority2 = (u8_t)(hostRand() % 2 ? 128 : hostRand() % 256);
+}
+
+/* 'events' random steps of RANDOM_MASTERS grandmasters: Announces, dataset
+ * changes, masters falling silent, the parent's Syncs stopping and coming
+ * back. After each bmc() the incremental best and runner-up have to be the
+ * ones a full scan finds */
+static void randomized(long events)
+{
+    static ptpClock_t ptpClock;
+    static runTimeOpts_t rtOpts;
+    static master_t masters[RANDOM_MASTERS];
+    foreignMasterDS_t *ds = &ptpClock.foreignMasterDS;
+    msgHeader_t header;
+    master_t *m;
+    s16_t best, second, last = 0, i;
+    u32_t now, changes = 0, silences = 0, faults = 0, aged = 0, evicted = 0;
+    long e, mismatches = 0, pairs = 0, disagreements = 0;
+    u16_t id;
+
+    hostPtpInit(&ptpClock, &rtOpts, RANDOM_RECORDS);
+    ptpClock.portDS.portState = PTP_LISTENING;
+
+    for (id = 0; id < RANDOM_MASTERS; id++) {
+        m = &masters[id];
+        memset(m, 0, sizeof(*m));
+        identity(m->announce.grandmasterIdentity, id);
+        randomDataset(&m->announce);
+        m->logInterval = (s8_t)(hostRand() % 3) - 1;
+    }
+
+    for (e = 0; e < events; e++) {
+        /* about one Announce per master and interval */
+        hostClockAdvance((s64_t)(hostRand() % (2000000000 / RANDOM_MASTERS)));
+        now = sys_now();
+        id = (u16_t)(hostRand() % RANDOM_MASTERS);
+        m = &masters[id];
+
+        switch (hostRand() % 16) {
+            case 0:
+                randomDataset(&m->announce);
+                changes++;
+                break;
+
+            case 1:
+                m->silentUntil = now + (u32_t)(hostRand() % 30000);
+                silences++;
+                break;
+
+            case 2:
+                if (ds->best >= 0 && foreignSyncFault(&ptpClock, &ptpClock.parentDS.parentPortIdentity, true))
+                    faults++;
+                break;
+
+            case 3:
+                identity(header.sourcePortIdentity.clockIdentity, id);
+                header.sourcePortIdentity.portNumber = 1;
+                foreignSyncFault(&ptpClock, &header.sourcePortIdentity, false);
+                break;
+
+            default:
+                break;
+        }
+
+        if ((s32_t)(now - m->silentUntil) >= 0) {
+            memset(&header, 0, sizeof(header));
+            identity(header.sourcePortIdentity.clockIdentity, id);
+            header.sourcePortIdentity.portNumber = 1;
+            header.sequenceId = m->sequenceId++;
+            header.logMessageInterval = m->logInterval;
+            if (ds->free < 0 && !known(ds, &header.sourcePortIdentity))
+                evicted++;
+            addForeign(&ptpClock, &header, &m->announce);
+
+            /* the key of the record just updated against all the others */
+            for (i = ds->newest >= 0 ? ds->records[ds->newest].older : -1; i >= 0; i = ds->records[i].older) {
+                pairs++;
+                if (!keyAgrees(&ds->records[ds->newest], &ds->records[i])) {
+                    if (disagreements++ < 10)
+                        printf("FAIL: randomized event %ld: packed keys of records %d and %d disagree with "
+                                "the field comparison\n", e, ds->newest, i);
+                    failures++;
+                }
+            }
+        }
+
+        last = ds->count;
+        ptpClock.portDS.portState = bmc(&ptpClock);
+        if (ds->count < last)
+            aged += last - ds->count;
+
+        scan(&ptpClock, &best, &second);
+        if (best != ds->best || second != ds->second) {
+            if (mismatches++ < 10)
+                printf("FAIL: randomized event %ld: best %d runner-up %d, full scan %d and %d\n",
+                        e, ds->best, ds->second, best, second);
+            failures++;
+        }
+    }
+
+    printf("randomized: %ld events  changes %lu  silences %lu  sync faults %lu  aged %lu  evictions %lu  "
+            "rescans %lu  mismatches %ld\n"
+            "randomized: %ld key pairs against the field comparison  disagreements %ld\n",
+            events, (unsigned long)changes, (unsigned long)silences, (unsigned long)faults,
+            (unsigned long)aged, (unsigned long)evicted, (unsigned long)ds->rescans, mismatches,
+            pairs, disagreements);
+
+    free(ds->records);
+    free(ds->buckets);
+}
+
+int main(int argc, char **argv)
+{
+    long count = argc > 1 ? atol(argv[1]) : 50;
+    long events = argc > 2 ? atol(argv[2]) : 200000;
+
+    expect(run(5, 5, count), "5 masters, slave to the best");
+    expect(run(64, 64, count), "64 masters, slave to the best");
+    expect(run(256, 256, count), "256 masters, slave to the best");
+    expect(run(512, 512, count), "512 masters, slave to the best");
+
+    /* More masters than records: the best and the parent must stay in */
+    expect(run(6, 5, count), "6 masters in 5 records, slave to the best");
+    expect(run(128, 64, count), "128 masters in 64 records, slave to the best");
+    expect(run(512, 64, count), "512 masters in 64 records, slave to the best");
+
+    syncFault();
+    variance();
+    randomized(events);
+
+    return failures ? EXIT_FAILURE : EXIT_SUCCESS;
+}
@@ -0,0 +1,142 @@
+/**
+ * @file
+ * @brief filter_test.c
+ * host property test of the exponential filter of the offset and the path
+ * delay. For random orders 0 to 16 and inputs across +-FILTER_MAX_NS:
+ * constant input passes through exactly, the output stays within the range
+ * of the input so far, and it tracks a double precision EMA with the same
+ * orders to under 1 ns. filterTime() gives the same values as filter() on
+ * inputs with a non-zero seconds part and leaves those out of range alone.
+ * servo.c is included for its static filter.
+ *
+ *   filter_test [runs]
+ */
+
+#include <math.h>
+#include <stdlib.h>
+
+#include "host.h"
+#include "../src/servo.c"
+
+#define SAMPLES         2000
+#define ORDER_MAX       16
+
+static int failures;
+
+static void expect(bool cond, const char *what, long run, long i)
+{
+    if (!cond) {
+        printf("FAIL: %s (run %ld, sample %ld)\n", what, run, i);
+        failures++;
+    }
+}
+
+/* Uniform in [-span, span] */
+static s64_t rndRange(s64_t span)
+{
+    return (s64_t)(hostRand() % (u64_t)(2 * span + 1)) - span;
+}
+
+/* An input sequence: a level anywhere in range with noise of a random
+ * amplitude, so both the small and the full scale steps are covered */
+static s64_t input(s64_t level, s64_t noise)
+{
+    s64_t x = level + rndRange(noise);
+
+    return x > FILTER_MAX_NS ? FILTER_MAX_NS : x < -FILTER_MAX_NS ? -FILTER_MAX_NS : x;
+}
+
+static void constant(long run)
+{
+    filter_t filt = { 0 };
+    s64_t c = rndRange(FILTER_MAX_NS), x;
+    long i;
+
+    filt.s = (s16_t)(hostRand() % (ORDER_MAX + 1));
+    for (i = 0; i < SAMPLES; i++) {
+        x = c;
+        filter(&x, &filt);
+        expect(x == c, "constant input passes through", run, i);
+    }
+}
+
+static void tracking(long run, double *maxError)
+{
+    filter_t filt = { 0 };
+    s64_t level = rndRange(FILTER_MAX_NS), noise = llabs(rndRange(FILTER_MAX_NS)), x, y, lo = 0, hi = 0;
+    double ema = 0, error;
+    long i;
+
+    filt.s = (s16_t)(hostRand() % (ORDER_MAX + 1));
+
+    for (i = 0; i < SAMPLES; i++) {
+        x = y = input(level, noise);
+        lo = i == 0 || x < lo ? x : lo;
+        hi = i == 0 || x > hi ? x : hi;
+
+        filter(&y, &filt);
+        expect(y >= lo && y <= hi, "output within the input range", run, i);
+
+        /* with the orders the filter used, warm-up included */
+        if (i == 0)
+            ema = (double)x;
+        else
+            ema += ((double)x - ema) / (double)(1 << filt.s_prev);
+
+        error = fabs((double)y - ema);
+        expect(error < 1.0, "within 1 ns of a double EMA", run, i);
+        if (error > *maxError)
+            *maxError = error;
+    }
+}
+
+/* filterTime() on the same inputs as filter(), with seconds in them */
+static void timeValues(long run)
+{
+    filter_t a = { 0 }, b = { 0 };
+    timeInternal_t t, out;
+    s64_t level = rndRange(FILTER_MAX_NS), x;
+    long i;
+
+    a.s = b.s = (s16_t)(hostRand() % (ORDER_MAX + 1));
+
+    for (i = 0; i < SAMPLES / 10; i++) {
+        x = input(level, 1000);
+        nanosecondsToInternalTime(x, &t);
+        expect(internalTimeToNanoseconds(&t) == x, "time conversion is exact", run, i);
+
+        expect(filterTime(&t, &a), "in range value filtered", run, i);
+        filter(&x, &b);
+        expect(internalTimeToNanoseconds(&t) == x, "filterTime() matches filter()", run, i);
+        expect(t.seconds == 0 || t.nanoseconds == 0 || (t.seconds < 0) == (t.nanoseconds < 0),
+            "seconds and nanoseconds agree in sign", run, i);
+    }
+
+    /* out of range: left alone and the filter is not touched */
+    nanosecondsToInternalTime(FILTER_MAX_NS + 1 + llabs(rndRange(FILTER_MAX_NS)), &t);
+    out = t;
+    b = a;
+    expect(!filterTime(&out, &a), "beyond +FILTER_MAX_NS is refused", run, 0);
+    expect(out.seconds == t.seconds && out.nanoseconds == t.nanoseconds && a.n == b.n && a.y_sum == b.y_sum,
+        "refused value and filter unchanged", run, 0);
+    nanosecondsToInternalTime(-FILTER_MAX_NS - 1, &t);
+    expect(!filterTime(&t, &a), "beyond -FILTER_MAX_NS is refused", run, 0);
+}
+
+int main(int argc, char **argv)
+{
+    long runs = argc > 1 ? atol(argv[1]) : 2000;
+    double maxError = 0;
+    long run;
+
+    for (run = 0; run < runs; run++) {
+        constant(run);
+        tracking(run, &maxError);
+        timeValues(run);
+    }
+
+    printf("%ld runs of %d samples, orders 0-%d: max error against a double EMA %.3f ns\n",
+        runs, SAMPLES, ORDER_MAX, maxError);
+
+    return failures ? EXIT_FAILURE : EXIT_SUCCESS;
+}
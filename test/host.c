@@ -0,0 +1,220 @@
+/**
+ * @file
+ * @brief host.c
+ * host stand-ins for the driver hooks of lwipopts.h and the few lwIP and
+ * network functions the servo, BMC and authentication code call.
+ */
+
+#include "host.h"
+
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "bmc.h"
+#include "net.h"
+
+static double clockNs; /* simulated local clock, fractional ns kept */
+static s32_t clockAdj; /* ppb */
+static u32_t clockSteps;
+static u64_t nowNs;
+static u64_t clockStart; /* nowNs at hostClockInit() */
+static s32_t thermalCoeff; /* ppb per degC */
+static s32_t thermalAmplitude; /* m degC */
+static u32_t thermalPeriod; /* s, 0 without the thermal model */
+static bool thermalSensor;
+static u64_t timerExpiry[LWIP_PTP_NUM_TIMERS];
+static bool timerRunning[LWIP_PTP_NUM_TIMERS];
+
+void hostClockInit(s64_t ns)
+{
+    clockNs = (double)ns;
+    clockAdj = 0;
+    clockSteps = 0;
+    clockStart = nowNs;
+}
+
+void hostClockThermal(s32_t coeff, s32_t amplitude, u32_t period, bool sensor)
+{
+    thermalCoeff = coeff;
+    thermalAmplitude = amplitude;
+    thermalPeriod = period;
+    thermalSensor = sensor;
+}
+
+/* Oscillator temperature 'ns' after hostClockInit(), m degC */
+static double thermal(u64_t ns)
+{
+    if (!thermalPeriod)
+        return HOST_TEMPERATURE;
+
+    return HOST_TEMPERATURE + thermalAmplitude * sin(2 * M_PI * (double)ns / (1e9 * thermalPeriod));
+}
+
+s64_t hostClockNs(void)
+{
+    return (s64_t)clockNs;
+}
+
+void hostClockAdvance(s64_t ns)
+{
+    /* the oscillator at the temperature halfway through */
+    double ppb = clockAdj + thermalCoeff * (thermal(nowNs - clockStart + ns / 2) - HOST_TEMPERATURE) / 1000;
+
+    clockNs += (double)ns * (1.0 + ppb * 1e-9);
+    nowNs += ns;
+}
+
+void hostClockShift(s64_t ns)
+{
+    clockNs += (double)ns;
+}
+
+u32_t hostClockSteps(void)
+{
+    return clockSteps;
+}
+
+s32_t hostClockAdj(void)
+{
+    return clockAdj;
+}
+
+u64_t hostNanos(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (u64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+/* xorshift64*, the runs are the same on every host */
+static u64_t randState = 0x9E3779B97F4A7C15ull;
+
+u64_t hostRand(void)
+{
+    randState ^= randState >> 12;
+    randState ^= randState << 25;
+    randState ^= randState >> 27;
+    return randState * 0x2545F4914F6CDD1Dull;
+}
+
+void hostPtpInit(ptpClock_t *ptpClock, runTimeOpts_t *rtOpts, u16_t records)
+{
+    memset(ptpClock, 0, sizeof(*ptpClock));
+    memset(rtOpts, 0, sizeof(*rtOpts));
+
+    rtOpts->announceInterval = DEFAULT_ANNOUNCE_INTERVAL;
+    rtOpts->syncInterval = DEFAULT_SYNC_INTERVAL;
+    rtOpts->clockQuality.clockAccuracy = DEFAULT_CLOCK_ACCURACY;
+    rtOpts->clockQuality.clockClass = DEFAULT_CLOCK_CLASS;
+    rtOpts->clockQuality.offsetScaledLogVariance = DEFAULT_CLOCK_VARIANCE;
+    rtOpts->priority1 = DEFAULT_PRIORITY1;
+    rtOpts->priority2 = DEFAULT_PRIORITY2;
+    rtOpts->domainNumber = DEFAULT_DOMAIN_NUMBER;
+    rtOpts->servo.type = LWIP_PTP_SERVO;
+    rtOpts->servo.sDelay = DEFAULT_DELAY_S;
+    rtOpts->servo.sOffset = DEFAULT_OFFSET_S;
+    rtOpts->servo.ap = DEFAULT_AP;
+    rtOpts->servo.ai = DEFAULT_AI;
+    rtOpts->servo.gainSteps = DEFAULT_GAIN_STEPS;
+    rtOpts->servo.maxSlew = DEFAULT_MAX_SLEW;
+    rtOpts->servo.holdoverAging = DEFAULT_HOLDOVER_AGING;
+    rtOpts->servo.acquireSamples = DEFAULT_ACQUIRE_SAMPLES;
+    rtOpts->servo.delayWindow = DEFAULT_DELAY_WINDOW;
+    rtOpts->servo.qPhase = DEFAULT_KALMAN_Q_PHASE;
+    rtOpts->servo.qFreq = DEFAULT_KALMAN_Q_FREQ;
+    rtOpts->servo.r = DEFAULT_KALMAN_R;
+    rtOpts->maxForeignRecords = records;
+    rtOpts->delayMechanism = DEFAULT_DELAY_MECHANISM;
+
+    ptpClock->rtOpts = rtOpts;
+    ptpClock->foreignMasterDS.records = calloc(records ? records : 1, sizeof(foreignMasterRecord_t));
+    ptpClock->foreignMasterDS.buckets = calloc(records ? records : 1, sizeof(s16_t));
+    ptpClock->portUuidField[5] = 1;
+
+    initData(ptpClock);
+}
+
+/*------------------------------ driver hooks --------------------------------*/
+
+void hostGetTime(timestamp_t *timestamp)
+{
+    s64_t ns = hostClockNs();
+
+    timestamp->secondsField.msb = 0;
+    timestamp->secondsField.lsb = (u32_t)(ns / 1000000000);
+    timestamp->nanosecondsField = (u32_t)(ns % 1000000000);
+}
+
+void hostSetTime(const timestamp_t *timestamp)
+{
+    clockNs = (double)timestamp->secondsField.lsb * 1e9 + timestamp->nanosecondsField;
+    clockSteps++;
+}
+
+void hostUpdateFine(s32_t adj)
+{
+    clockAdj = adj;
+}
+
+bool hostGetTemperature(s32_t *temperature)
+{
+    if (!thermalPeriod || !thermalSensor)
+        return false;
+
+    *temperature = (s32_t)lround(thermal(nowNs - clockStart));
+    return true;
+}
+
+err_t hostInitTimers(void)
+{
+    int i;
+
+    for (i = 0; i < LWIP_PTP_NUM_TIMERS; i++)
+        timerRunning[i] = false;
+    return ERR_OK;
+}
+
+void hostStartTimer(u32_t idx, u32_t interval)
+{
+    timerExpiry[idx] = nowNs / 1000000 + interval;
+    timerRunning[idx] = true;
+}
+
+void hostStopTimer(u32_t idx)
+{
+    timerRunning[idx] = false;
+}
+
+bool hostCheckTimer(u32_t idx)
+{
+    if (!timerRunning[idx] || nowNs / 1000000 < timerExpiry[idx])
+        return false;
+
+    timerRunning[idx] = false;
+    return true;
+}
+
+/*------------------------------ lwIP and net --------------------------------*/
+
+u32_t sys_now(void)
+{
+    return (u32_t)(nowNs / 1000000);
+}
+
+u32_t lwip_htonl(u32_t x)
+{
+    return ((x & 0xFF) << 24) | ((x & 0xFF00) << 8) | ((x >> 8) & 0xFF00) | (x >> 24);
+}
+
+u16_t lwip_htons(u16_t x)
+{
+    return (u16_t)((x << 8) | (x >> 8));
+}
+
+void netEmptyEventQ(netPath_t *netPath)
+{
+    UNUSED(netPath);
+}
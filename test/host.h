@@ -0,0 +1,51 @@
+#ifndef __LWIP_PTP_TEST_HOST_H__
+#define __LWIP_PTP_TEST_HOST_H__
+
+/**
+ * @file
+ * @brief host stand-ins for the driver hooks of lwipopts.h: a simulated
+ * local clock that the servos steer, virtual timers and sys_now()
+ */
+
+#include "lwip-ptp.h"
+#include "def/datatypes_private.h"
+
+/* Set the simulated clock to 'ns' with no frequency adjustment */
+void hostClockInit(s64_t ns);
+
+/* Current time of the simulated clock (ns) */
+s64_t hostClockNs(void);
+
+/* Let 'ns' of true time pass: the clock runs at the frequency adjustment
+ * set through LWIP_PTP_UPDATE_FINE, and sys_now() advances with it */
+void hostClockAdvance(s64_t ns);
+
+/* Shift the simulated clock by 'ns' (oscillator phase error) */
+void hostClockShift(s64_t ns);
+
+/* Oscillator temperature of the thermal model at rest, m degC */
+#define HOST_TEMPERATURE    25000
+
+/* Thermal model: the temperature swings by 'amplitude' m degC around
+ * HOST_TEMPERATURE with a 'period' in s, 0 for none, and the oscillator
+ * frequency follows it by 'coeff' ppb per degC. With 'sensor' the
+ * temperature is read through LWIP_PTP_GET_TEMPERATURE */
+void hostClockThermal(s32_t coeff, s32_t amplitude, u32_t period, bool sensor);
+
+/* Number of LWIP_PTP_SET_TIME calls since hostClockInit() */
+u32_t hostClockSteps(void);
+
+/* Frequency adjustment last set, ppb */
+s32_t hostClockAdj(void);
+
+/* Fill rtOpts with the defaults of ptpd_thread(), give ptpClock a foreign
+ * master table of 'records' entries and run initData() */
+void hostPtpInit(ptpClock_t *ptpClock, runTimeOpts_t *rtOpts, u16_t records);
+
+/* Monotonic host time for benchmarks (ns) */
+u64_t hostNanos(void);
+
+/* Pseudo-random numbers, the same sequence on every host */
+u64_t hostRand(void);
+
+#endif /* __LWIP_PTP_TEST_HOST_H__ */
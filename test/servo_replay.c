@@ -0,0 +1,277 @@
+/**
+ * @file
+ * @brief servo_replay.c
+ * drives the clock servos with the same recorded offset trace. The trace is
+ * the offset from master of a free running clock, one value in ns per Sync
+ * (what a slave logs with servo.noAdjust set), '#' starts a comment. Each
+ * servo steers the simulated clock of host.c: every Sync it sees the trace
+ * plus what it corrected so far, so each servo gets the same oscillator and
+ * timestamp noise in closed loop. Without a trace a synthetic one is made
+ * from a frequency offset (-f ppm), a random walk of the frequency
+ * (-r ppb/sqrt(s)) and white timestamp noise (-j ns). On top of either the
+ * oscillator can follow a sinusoidal temperature (-t ppb/degC,degC,s) that
+ * the servo reads, as it would a sensor next to the oscillator, and learns
+ * the feed-forward of; -T keeps the temperature from the servo.
+ *
+ *   servo_replay [-s pi|linreg|kalman] [-l logSyncInterval] [-g gainSteps]
+ *                [-n syncs] [-f ppm] [-r ppb] [-j ns] [-t coeff,amplitude,period]
+ *                [-T] [-c] [-w written.trace] [-v] [trace]
+ *
+ * Prints, per servo, when the offset first stays below 1 us, and the rms and
+ * peak offset over the second half, with the learned temperature
+ * coefficient in ppt/degC once the feed-forward is applied. With -c the PI
+ * servo is replayed with fixed gains (-g 0) as well: the gain schedule has
+ * to loosen again when the offset shows a bias, so under wander it must not
+ * do more than GAIN_MARGIN worse than them. For a recorded trace the offset is the
+ * one measured, timestamp noise included; a synthetic trace keeps its noise
+ * apart, only the timestamps see it and the true offset is shown. Fails if a
+ * servo does not lock.
+ */
+
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "host.h"
+#include "servo.h"
+
+#define LOCK_NS         1000
+#define GAIN_MARGIN     1.1 /* rms of the gain schedule against fixed gains */
+
+typedef struct {
+    s64_t *offset; /**< clock offset, ns */
+    s32_t *noise; /**< timestamp noise, ns, if known */
+    long n;
+    long size;
+} trace_t;
+
+/* Synthetic trace */
+static double freqPpm = 20, walkPpb = 0.2, noiseNs = 50;
+
+/* Thermal model */
+static double thermalCoeff, thermalAmplitude;
+static long thermalPeriod;
+static bool thermalSensor = true;
+
+static ptpClock_t ptpClock;
+static runTimeOpts_t rtOpts;
+
+static void push(trace_t *trace, s64_t offset, s32_t noise)
+{
+    if (trace->n == trace->size) {
+        trace->size = trace->size ? trace->size * 2 : 1024;
+        trace->offset = realloc(trace->offset, trace->size * sizeof(*trace->offset));
+        trace->noise = realloc(trace->noise, trace->size * sizeof(*trace->noise));
+        if (!trace->offset || !trace->noise) {
+            perror("realloc");
+            exit(EXIT_FAILURE);
+        }
+    }
+    trace->offset[trace->n] = offset;
+    trace->noise[trace->n++] = noise;
+}
+
+static void readTrace(trace_t *trace, const char *path)
+{
+    char line[128];
+    FILE *f = fopen(path, "r");
+
+    if (!f) {
+        perror(path);
+        exit(EXIT_FAILURE);
+    }
+    while (fgets(line, sizeof(line), f)) {
+        if (line[0] != '#' && line[0] != '\n')
+            push(trace, strtoll(line, NULL, 10), 0);
+    }
+    fclose(f);
+}
+
+static double gauss(void)
+{
+    double u = (rand() + 1.0) / (RAND_MAX + 2.0), v = (rand() + 1.0) / (RAND_MAX + 2.0);
+
+    return sqrt(-2 * log(u)) * cos(2 * M_PI * v);
+}
+
+static void makeTrace(trace_t *trace, long n, int logSync)
+{
+    double interval = pow(2, logSync), phase = 20000, freq = freqPpm * 1000;
+    long i;
+
+    srand(1);
+    for (i = 0; i < n; i++) {
+        freq += walkPpb * sqrt(interval) * gauss();
+        phase += freq * interval;
+        push(trace, (s64_t)phase, (s32_t)(noiseNs * gauss()));
+    }
+}
+
+static void writeTrace(const trace_t *trace, const char *path)
+{
+    FILE *f = fopen(path, "w");
+    long i;
+
+    if (!f) {
+        perror(path);
+        exit(EXIT_FAILURE);
+    }
+    fprintf(f, "# offset from master of a free running clock, ns per Sync\n");
+    for (i = 0; i < trace->n; i++)
+        fprintf(f, "%lld\n", (long long)trace->offset[i] + trace->noise[i]);
+    fclose(f);
+}
+
+static timeInternal_t internal(s64_t ns)
+{
+    timeInternal_t t;
+
+    t.seconds = (s32_t)(ns / 1000000000);
+    t.nanoseconds = (s32_t)(ns % 1000000000);
+    return t;
+}
+
+static const char *servoName(u8_t type)
+{
+    switch (type) {
+        case SERVO_PI: return "pi";
+        case SERVO_LINREG: return "linreg";
+        case SERVO_KALMAN: return "kalman";
+        default: return "?";
+    }
+}
+
+/* Replay the trace through one servo, false if it never locked. Gives the
+ * rms offset and the mean PI gain step over the second half */
+static bool replay(const trace_t *trace, u8_t type, int logSync, int gainSteps, bool verbose,
+                   double *rms, double *step)
+{
+    const s64_t interval = (s64_t)(pow(2, logSync) * 1e9);
+    const timeInternal_t zero = { 0, 0 };
+    s64_t master = 100 * (s64_t)1000000000, offset, peak = 0;
+    timeInternal_t ingress, origin;
+    double sum2 = 0, steps = 0;
+    long i, locked = -1, n2 = 0;
+
+    hostPtpInit(&ptpClock, &rtOpts, 0);
+    ptpClock.servo.type = type;
+    if (gainSteps >= 0)
+        ptpClock.servo.gainSteps = gainSteps;
+    ptpClock.portDS.logSyncInterval = logSync;
+    ptpClock.portDS.portState = PTP_SLAVE;
+    hostClockInit(master);
+    hostClockThermal((s32_t)thermalCoeff, (s32_t)(thermalAmplitude * 1000), (u32_t)thermalPeriod, thermalSensor);
+    initClock(&ptpClock);
+
+    for (i = 0; i < trace->n; i++) {
+        master += interval;
+        hostClockAdvance(interval);
+        hostClockShift(trace->offset[i] - (i ? trace->offset[i - 1] : 0));
+
+        /* as doState() does before it handles the Sync */
+        tempUpdate(&ptpClock);
+
+        ingress = internal(hostClockNs() + trace->noise[i]);
+        origin = internal(master);
+        ptpClock.timestamp_syncRecieve = ingress;
+        if (updateOffset(&ptpClock, &ingress, &origin, &zero))
+            updateClock(&ptpClock);
+
+        offset = hostClockNs() - master;
+        if (llabs(offset) >= LOCK_NS)
+            locked = -1;
+        else if (locked < 0)
+            locked = i;
+
+        if (i >= trace->n / 2) {
+            sum2 += (double)offset * offset;
+            steps += ptpClock.servoData.pi.step;
+            n2++;
+            if (llabs(offset) > peak)
+                peak = llabs(offset);
+        }
+
+        if (verbose)
+            printf("%s %ld %lld %d\n", servoName(type), i, (long long)offset, ptpClock.observedDrift);
+    }
+
+    *rms = n2 ? sqrt(sum2 / n2) : 0;
+    *step = n2 ? steps / n2 : 0;
+    printf("%-7s locked after %5ld syncs  rms %8.1f ns  peak %7lld ns  drift %6d ppb  steps %u",
+        servoName(type), locked, *rms, (long long)peak,
+        ptpClock.observedDrift, hostClockSteps());
+    if (ptpClock.tempComp.valid)
+        printf("  tempco %lld ppt/degC", (long long)((ptpClock.tempComp.coeff * 1000000) >> ADJ_FREQ_SCALE));
+    printf("\n");
+
+    return locked >= 0 && locked < trace->n / 2;
+}
+
+int main(int argc, char **argv)
+{
+    trace_t trace = { NULL, NULL, 0, 0 };
+    const char *write = NULL;
+    int opt, logSync = 0, gainSteps = -1, servo = -1, failed = 0;
+    long syncs = 2000;
+    bool verbose = false, compare = false;
+    double rms, step, fixedRms, fixedStep;
+    u8_t type;
+
+    while ((opt = getopt(argc, argv, "s:l:g:n:f:r:j:t:Tcw:v")) != -1) {
+        switch (opt) {
+            case 's':
+                servo = !strcmp(optarg, "pi") ? SERVO_PI : !strcmp(optarg, "linreg") ? SERVO_LINREG :
+                        !strcmp(optarg, "kalman") ? SERVO_KALMAN : -2;
+                break;
+            case 'l': logSync = atoi(optarg); break;
+            case 'g': gainSteps = atoi(optarg); break;
+            case 'n': syncs = atol(optarg); break;
+            case 'f': freqPpm = atof(optarg); break;
+            case 'r': walkPpb = atof(optarg); break;
+            case 'j': noiseNs = atof(optarg); break;
+            case 't':
+                if (sscanf(optarg, "%lf,%lf,%ld", &thermalCoeff, &thermalAmplitude, &thermalPeriod) != 3 ||
+                        thermalPeriod <= 0)
+                    servo = -2;
+                break;
+            case 'T': thermalSensor = false; break;
+            case 'c': compare = true; break;
+            case 'w': write = optarg; break;
+            case 'v': verbose = true; break;
+            default: servo = -2; break;
+        }
+    }
+    if (servo == -2 || logSync < LOG_INTERVAL_MIN || logSync > LOG_INTERVAL_MAX || gainSteps > GAIN_STEPS_MAX) {
+        fprintf(stderr, "usage: %s [-s pi|linreg|kalman] [-l logSyncInterval] [-g gainSteps] [-n syncs]\n"
+                        "       [-f ppm] [-r ppb] [-j ns] [-t ppb/degC,degC,s] [-T] [-c] [-w file]\n"
+                        "       [-v] [trace]\n",
+                argv[0]);
+        return EXIT_FAILURE;
+    }
+
+    if (optind < argc)
+        readTrace(&trace, argv[optind]);
+    else
+        makeTrace(&trace, syncs, logSync);
+
+    if (write)
+        writeTrace(&trace, write);
+
+    for (type = SERVO_PI; type <= SERVO_KALMAN; type++) {
+        if ((servo < 0 || servo == type) && servoAvailable(type))
+            failed += !replay(&trace, type, logSync, gainSteps, verbose, &rms, &step);
+
+        if (compare && type == SERVO_PI && (servo < 0 || servo == type)) {
+            failed += !replay(&trace, type, logSync, 0, verbose, &fixedRms, &fixedStep);
+            printf("%-7s gain schedule rms %.1f ns at mean step %.2f, fixed gains %.1f ns\n",
+                servoName(type), rms, step, fixedRms);
+            if (rms > fixedRms * GAIN_MARGIN) {
+                printf("FAIL: the gain schedule does worse than fixed gains\n");
+                failed++;
+            }
+        }
+    }
+
+    return failed ? EXIT_FAILURE : EXIT_SUCCESS;
+}
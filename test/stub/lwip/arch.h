@@ -0,0 +1,32 @@
+/* Host stand-in for lwIP's arch.h: just enough for the host tests */
+#ifndef LWIP_HDR_ARCH_H
+#define LWIP_HDR_ARCH_H
+
+#include <limits.h>
+#include <stdint.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <sys/types.h>
+
+typedef uint8_t u8_t;
+typedef int8_t s8_t;
+typedef uint16_t u16_t;
+typedef int16_t s16_t;
+typedef uint32_t u32_t;
+typedef int32_t s32_t;
+typedef uint64_t u64_t;
+typedef int64_t s64_t;
+typedef s8_t err_t;
+
+#define ERR_OK      0
+#define ERR_MEM     -1
+#define ERR_VAL     -6
+#define ERR_ARG     -16
+
+#ifndef BYTE_ORDER
+#define LITTLE_ENDIAN 1234
+#define BIG_ENDIAN 4321
+#define BYTE_ORDER LITTLE_ENDIAN
+#endif
+
+#endif /* LWIP_HDR_ARCH_H */
@@ -0,0 +1,14 @@
+/* Host stand-in for lwIP's ip_addr.h */
+#ifndef LWIP_HDR_IP_ADDR_H
+#define LWIP_HDR_IP_ADDR_H
+
+#include "lwip/arch.h"
+
+typedef struct { u32_t addr; } ip_addr_t;
+
+u32_t lwip_htonl(u32_t x);
+u16_t lwip_htons(u16_t x);
+#define htonl lwip_htonl
+#define htons lwip_htons
+
+#endif /* LWIP_HDR_IP_ADDR_H */
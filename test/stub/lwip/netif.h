@@ -0,0 +1,11 @@
+/* Host stand-in for lwIP's netif.h */
+#ifndef LWIP_HDR_NETIF_H
+#define LWIP_HDR_NETIF_H
+
+#include "lwip/ip_addr.h"
+
+#define NETIF_MAX_HWADDR_LEN 6
+
+struct netif { ip_addr_t ip_addr; };
+
+#endif /* LWIP_HDR_NETIF_H */
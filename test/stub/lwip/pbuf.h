@@ -0,0 +1,16 @@
+/* Host stand-in for lwIP's pbuf.h */
+#ifndef LWIP_HDR_PBUF_H
+#define LWIP_HDR_PBUF_H
+
+#include "lwip/arch.h"
+
+struct pbuf {
+    struct pbuf *next;
+    void *payload;
+    u16_t tot_len;
+    u16_t len;
+    u32_t tv_sec;
+    u32_t tv_nsec;
+};
+
+#endif /* LWIP_HDR_PBUF_H */
@@ -0,0 +1,12 @@
+/* Host stand-in for lwIP's sys.h */
+#ifndef LWIP_HDR_SYS_H
+#define LWIP_HDR_SYS_H
+
+#include "lwip/arch.h"
+
+typedef int sys_mbox_t;
+typedef int sys_sem_t;
+
+u32_t sys_now(void);
+
+#endif /* LWIP_HDR_SYS_H */
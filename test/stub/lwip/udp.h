@@ -0,0 +1,10 @@
+/* Host stand-in for lwIP's udp.h */
+#ifndef LWIP_HDR_UDP_H
+#define LWIP_HDR_UDP_H
+
+#include "lwip/pbuf.h"
+#include "lwip/ip_addr.h"
+
+struct udp_pcb { u16_t local_port; };
+
+#endif /* LWIP_HDR_UDP_H */
@@ -0,0 +1,20 @@
+/* lwipopts.h for the host tests: every optional servo and authentication
+ * built in, the driver hooks go to the simulated clock in host.c */
+#ifndef LWIP_LWIPOPTS_H
+#define LWIP_LWIPOPTS_H
+
+#define LWIP_PTP                    1
+#define LWIP_PTP_AUTH               1
+#define LWIP_PTP_SERVO_LINREG       1
+#define LWIP_PTP_SERVO_KALMAN       1
+
+#define LWIP_PTP_GET_TIME           hostGetTime
+#define LWIP_PTP_SET_TIME           hostSetTime
+#define LWIP_PTP_UPDATE_FINE        hostUpdateFine
+#define LWIP_PTP_INIT_TIMERS        hostInitTimers
+#define LWIP_PTP_START_TIMER        hostStartTimer
+#define LWIP_PTP_STOP_TIMER         hostStopTimer
+#define LWIP_PTP_CHECK_TIMER        hostCheckTimer
+#define LWIP_PTP_GET_TEMPERATURE    hostGetTemperature
+
+#endif /* LWIP_LWIPOPTS_H */